@@ -3,7 +3,8 @@
 
 #include <iostream>
 #include <Eigen/Dense>
-#include "ros/ros.h"
+#include "ekf_engine.h"
+#include "pose_filter.h"
 #include "math.h"
 
 #define PI 3.14159265358979323846
@@ -11,18 +12,6 @@
 namespace ekf
 {
 
-struct GnssObservation
-{
-  double x, y, theta;
-  double sigma_x, sigma_y, sigma_theta;
-};
-
-struct OdomAction
-{
-  double delta_x, delta_y, delta_theta;
-  double sigma_x, sigma_y, sigma_theta;
-};
-
 struct KalmanConfiguration
 {
   double x_ini, y_ini, theta_ini;
@@ -34,24 +23,18 @@ struct KalmanConfiguration
 class CEkf;
 typedef CEkf* CEkfPtr;
 
-class CEkf
+class CEkf : public CPoseFilter
 {
 private:
-  Eigen::Matrix<double, 3, 1> X_;
-  Eigen::Matrix<double, 3, 3> F_X_;
-  Eigen::Matrix<double, 3, 3> F_u_;
-  Eigen::Matrix<double, 3, 3> F_q_;
-  Eigen::Matrix<double, 3, 3> Q_;
-  Eigen::Matrix<double, 3, 3> P_;
-  Eigen::Matrix<double, 3, 3> H_;
+  // 3-DoF pose (x, y, theta) observed directly by the GNSS fix
+  ekf::CEkfEngine<3, 3> engine_;
 
   ekf::KalmanConfiguration config_;
 
-  double wheelbase_;
-
   bool debug_;
 
 public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
   bool flag_ekf_initialised_;
 
@@ -59,7 +42,17 @@ public:
 
   ~CEkf(void);
 
-  void predict(ekf::OdomAction act);
+  bool isInitialised(void)
+  {
+    return flag_ekf_initialised_;
+  }
+
+  void setInitialised(bool initialised)
+  {
+    flag_ekf_initialised_ = initialised;
+  }
+
+  void predict(ekf::OdomAction act, unsigned int n_steps = 1);
 
   double update(ekf::GnssObservation obs);
 
@@ -67,6 +60,11 @@ public:
   
   void setStateAndCovariance(Eigen::Matrix<double, 3, 1> state, Eigen::Matrix<double, 3, 3> covariance);
 
+  bool needsHeadingProtection(void)
+  {
+    return true;
+  }
+
   void setDebug(bool debug)
   {
     debug_ = debug;
@@ -0,0 +1,81 @@
+#ifndef _ekf_checkpoint_h_
+#define _ekf_checkpoint_h_
+
+#include <stdint.h>
+#include <string>
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+namespace ekf
+{
+
+struct CheckpointData
+{
+  double wall_time; // [s] since the epoch, when it was stored
+  Eigen::Matrix<double, 3, 1> state;
+  Eigen::Matrix<double, 3, 3> covariance;
+  Eigen::Isometry3d map2odom;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+}
+
+class CEkfCheckpoint;
+typedef CEkfCheckpoint* CEkfCheckpointPtr;
+
+/**
+ * \brief Filter state kept in a small memory-mapped file to warm-start the node
+ *
+ * store() only writes to the mapped page, so it costs a few stores per filter
+ * step; the kernel keeps the page if the process dies and writes it back to
+ * the file. A sequence number that is odd while a record is being written lets
+ * load() reject a record torn by a crash.
+ */
+class CEkfCheckpoint
+{
+private:
+  struct Record
+  {
+    uint64_t magic;
+    uint64_t sequence;
+    double wall_time;
+    double state[3];
+    double covariance[9];
+    double translation[3];
+    double rotation[4]; // x, y, z, w
+  };
+
+  static const uint64_t MAGIC;
+
+  int fd_;
+  Record* record_;
+
+public:
+  CEkfCheckpoint(void);
+
+  ~CEkfCheckpoint(void);
+
+  /**
+   * \brief Opens (or creates) and maps the checkpoint file
+   * \return false if the file can not be opened or mapped
+   */
+  bool open(const std::string& path);
+
+  void close(void);
+
+  bool isOpen(void)
+  {
+    return record_ != NULL;
+  }
+
+  /**
+   * \brief Reads the stored checkpoint
+   * \return false if there is none, it is corrupted or older than max_age seconds
+   */
+  bool load(ekf::CheckpointData& data, double max_age);
+
+  void store(const Eigen::Matrix<double, 3, 1>& state, const Eigen::Matrix<double, 3, 3>& covariance,
+             const Eigen::Isometry3d& map2odom);
+};
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef _ekf_engine_h_
+#define _ekf_engine_h_
+
+#include <cmath>
+#include <Eigen/Dense>
+
+namespace ekf
+{
+
+/**
+ * \brief Structure flags for a filter whose Jacobians are all identity
+ *
+ * F_X = I, F_q = I and H = [I 0] (the measurement observes the first
+ * MeasDim state components). This is the 3-DoF pose model used by CEkf.
+ */
+struct IdentityStructure
+{
+  static const bool kIdentityTransition = true;
+  static const bool kIdentityNoiseJacobian = true;
+  static const bool kSelectionObservation = true;
+};
+
+/**
+ * \brief Structure flags for a filter with a general transition model
+ *
+ * F_X and F_q are set by the user before predict(). The observation still
+ * selects the first MeasDim components (e.g. a pose+velocity state observed
+ * by a pose-only GNSS fix).
+ */
+struct TransitionStructure
+{
+  static const bool kIdentityTransition = false;
+  static const bool kIdentityNoiseJacobian = false;
+  static const bool kSelectionObservation = true;
+};
+
+/**
+ * \brief Result of a filter update
+ */
+struct UpdateResult
+{
+  double mahalanobis_distance;
+  double likelihood;
+  bool accepted;
+};
+
+/**
+ * \brief Header-only Kalman filter core parameterised on state and measurement dimension
+ *
+ * The Structure flags are compile-time constants, so the identity products are
+ * removed by the compiler instead of being computed as dense multiplies. Every
+ * update factorises the innovation covariance once (LDLT) and reuses it for the
+ * Mahalanobis gate, the likelihood and the Kalman gain. All storage is fixed-size,
+ * nothing is allocated on the heap.
+ */
+template<int StateDim, int MeasDim, class Structure = IdentityStructure>
+  class CEkfEngine
+  {
+  public:
+    typedef Eigen::Matrix<double, StateDim, 1> StateVector;
+    typedef Eigen::Matrix<double, StateDim, StateDim> StateMatrix;
+    typedef Eigen::Matrix<double, MeasDim, 1> MeasVector;
+    typedef Eigen::Matrix<double, MeasDim, MeasDim> MeasMatrix;
+    typedef Eigen::Matrix<double, MeasDim, StateDim> ObservationMatrix;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    CEkfEngine(void)
+    {
+      X_.setZero();
+      P_.setIdentity();
+      Q_.setZero();
+      F_X_.setIdentity();
+      F_q_.setIdentity();
+      H_.setZero();
+      H_.template leftCols<MeasDim>().setIdentity();
+    }
+
+    /**
+     * \brief State prediction X = F_X * X + u, P = F_X * P * F_X^T + noise_scale * F_q * Q * F_q^T
+     */
+    void predict(const StateVector& u, double noise_scale = 1.0)
+    {
+      if (Structure::kIdentityTransition)
+      {
+        X_ += u;
+        if (Structure::kIdentityNoiseJacobian)
+          P_ += noise_scale * Q_;
+        else
+          P_.noalias() += noise_scale * (F_q_ * Q_ * F_q_.transpose());
+      }
+      else
+      {
+        X_ = F_X_ * X_ + u;
+        StateMatrix FP = F_X_ * P_;
+        P_.noalias() = FP * F_X_.transpose();
+        if (Structure::kIdentityNoiseJacobian)
+          P_ += noise_scale * Q_;
+        else
+          P_.noalias() += noise_scale * (F_q_ * Q_ * F_q_.transpose());
+      }
+    }
+
+    /**
+     * \brief Measurement update with an already computed innovation z = y - h(X)
+     *
+     * The state is only corrected when the Mahalanobis distance is below the gate.
+     */
+    UpdateResult update(const MeasVector& z, const MeasMatrix& R, double mahalanobis_gate)
+    {
+      // H * P (rows of P selected by H in the identity case)
+      Eigen::Matrix<double, MeasDim, StateDim> HP;
+      if (Structure::kSelectionObservation)
+        HP = P_.template topRows<MeasDim>();
+      else
+        HP.noalias() = H_ * P_;
+
+      // Innovation covariance
+      MeasMatrix Z;
+      if (Structure::kSelectionObservation)
+        Z = HP.template leftCols<MeasDim>() + R;
+      else
+        Z.noalias() = HP * H_.transpose() + R;
+
+      Eigen::LDLT<MeasMatrix> ldlt(Z);
+
+      UpdateResult result;
+      result.mahalanobis_distance = std::sqrt(z.dot(ldlt.solve(z)));
+      result.likelihood = std::exp(-0.5 * result.mahalanobis_distance) / std::sqrt(ldlt.vectorD().prod());
+      result.accepted = result.mahalanobis_distance < mahalanobis_gate;
+
+      if (result.accepted)
+      {
+        // Kalman gain K = P * H^T * Z^-1, i.e. K^T = Z^-1 * (H * P) since P is symmetric
+        Eigen::Matrix<double, StateDim, MeasDim> K = ldlt.solve(HP).transpose();
+
+        // State correction
+        X_.noalias() += K * z;
+
+        // State covariance correction P = (I - K * H) * P
+        P_.noalias() -= K * HP;
+      }
+      return result;
+    }
+
+    const StateVector& state(void) const
+    {
+      return X_;
+    }
+
+    StateVector& state(void)
+    {
+      return X_;
+    }
+
+    const StateMatrix& covariance(void) const
+    {
+      return P_;
+    }
+
+    StateMatrix& covariance(void)
+    {
+      return P_;
+    }
+
+    void setProcessNoise(const StateMatrix& Q)
+    {
+      Q_ = Q;
+    }
+
+    void setTransitionJacobian(const StateMatrix& F_X)
+    {
+      F_X_ = F_X;
+    }
+
+    void setNoiseJacobian(const StateMatrix& F_q)
+    {
+      F_q_ = F_q;
+    }
+
+    void setObservationMatrix(const ObservationMatrix& H)
+    {
+      H_ = H;
+    }
+
+  private:
+    StateVector X_;
+    StateMatrix P_;
+    StateMatrix Q_;
+    StateMatrix F_X_;
+    StateMatrix F_q_;
+    ObservationMatrix H_;
+  };
+
+}
+
+#endif
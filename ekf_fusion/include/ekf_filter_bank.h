@@ -0,0 +1,111 @@
+#ifndef _ekf_filter_bank_h_
+#define _ekf_filter_bank_h_
+
+#include <vector>
+#include <Eigen/Dense>
+#include "ekf.h"
+
+class CEkfFilterBank;
+typedef CEkfFilterBank* CEkfFilterBankPtr;
+
+/**
+ * \brief N independent 3-DoF pose filters (one per vehicle) in structure-of-arrays form
+ *
+ * Each vehicle behaves exactly like a CEkf with the same configuration. States
+ * and the six unique entries of the symmetric covariances are stored in
+ * separate contiguous lanes, and the predict and update kernels run branch-free
+ * on fixed-size Eigen packets of PACKET_SIZE vehicles, so they are vectorised
+ * by Eigen (SSE/AVX/NEON) whatever the floating point flags of the build.
+ */
+class CEkfFilterBank
+{
+private:
+  typedef std::vector<double, Eigen::aligned_allocator<double> > Lane;
+
+  static const size_t PACKET_SIZE = 4;
+  typedef Eigen::Array<double, PACKET_SIZE, 1> Packet;
+
+  ekf::KalmanConfiguration config_;
+  double q_xx_, q_yy_, q_tt_;
+
+  size_t size_;
+
+  // 1.0 when the vehicle filter is initialised, 0.0 otherwise
+  Lane active_;
+
+  // state lanes
+  Lane x_, y_, theta_;
+
+  // covariance lanes (upper triangle)
+  Lane p_xx_, p_xy_, p_xt_, p_yy_, p_yt_, p_tt_;
+
+  // staging lanes for batched updates (one entry per observation)
+  Lane s_x_, s_y_, s_t_;
+  Lane s_xx_, s_xy_, s_xt_, s_yy_, s_yt_, s_tt_;
+  Lane z_x_, z_y_, z_t_, r_xx_, r_yy_, r_tt_, likelihood_;
+  std::vector<size_t> batch_ids_;
+  std::vector<size_t> batch_index_;
+  std::vector<unsigned int> batch_mark_;
+  unsigned int batch_counter_;
+
+  /**
+   * \brief Innovation with the same angle handling as CEkf::update
+   */
+  void innovation(size_t id, const ekf::GnssObservation& obs, double& z_x, double& z_y, double& z_t);
+
+  /**
+   * \brief Update kernel over the staged observations [0, n)
+   */
+  void updateKernel(size_t n);
+
+public:
+  CEkfFilterBank(ekf::KalmanConfiguration kalman_configuration, size_t n_vehicles);
+
+  ~CEkfFilterBank(void);
+
+  size_t size(void)
+  {
+    return size_;
+  }
+
+  bool isInitialised(size_t id)
+  {
+    return active_[id] != 0.0;
+  }
+
+  void setInitialised(size_t id, bool initialised)
+  {
+    active_[id] = initialised ? 1.0 : 0.0;
+  }
+
+  /**
+   * \brief Prediction of one vehicle
+   */
+  void predict(size_t id, const ekf::OdomAction& act);
+
+  /**
+   * \brief Prediction of every vehicle; the arrays hold one delta per vehicle
+   * (zero for vehicles without new odometry)
+   */
+  void predictAll(const double* delta_x, const double* delta_y, const double* delta_theta);
+
+  /**
+   * \brief Update of one vehicle, returns the likelihood as CEkf::update
+   */
+  double update(size_t id, const ekf::GnssObservation& obs);
+
+  /**
+   * \brief Update of a batch of observations, one vehicle id per observation
+   *
+   * A vehicle may appear several times in the batch, its observations are then
+   * applied in order.
+   */
+  void updateBatch(const size_t* ids, const ekf::GnssObservation* obs, size_t n, double* likelihoods);
+
+  void getStateAndCovariance(size_t id, Eigen::Matrix<double, 3, 1>& state, Eigen::Matrix<double, 3, 3>& covariance);
+
+  void setStateAndCovariance(size_t id, const Eigen::Matrix<double, 3, 1>& state,
+                             const Eigen::Matrix<double, 3, 3>& covariance);
+};
+
+#endif
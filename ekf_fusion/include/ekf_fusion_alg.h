@@ -37,7 +37,15 @@
 #include <tf/transform_broadcaster.h>
 #include "geometry_msgs/PoseWithCovarianceStamped.h"
 #include "nav_msgs/Odometry.h"
-#include "ekf.h"
+#include "tf2_msgs/TFMessage.h"
+#include "ekf_fusion/GetPoseHistory.h"
+#include "ekf_fusion_core.h"
+#include "ekf_checkpoint.h"
+#include "latency_histogram.h"
+#include "pose_history.h"
+#include "ekf_state_snapshot.h"
+#include "ekf_transform_cache.h"
+#include "ekf_transform_broadcaster.h"
 #include "ackermann_msgs/AckermannDriveStamped.h"
 #include "tf_conversions/tf_eigen.h"
 #include <eigen_conversions/eigen_msg.h>
@@ -31,6 +31,7 @@
 #ifndef _ekf_fusion_alg_node_h_
 #define _ekf_fusion_alg_node_h_
 
+#include <mutex>
 #include <iri_base_algorithm/iri_base_algorithm.h>
 #include "ekf_fusion_alg.h"
 
@@ -49,18 +50,58 @@ class EkfFusionAlgNode : public algorithm_base::IriBaseAlgorithm<EkfFusionAlgori
 private:
 
   ekf::KalmanConfiguration kalman_config_;
-  CEkfPtr ekf_;
-  bool flag_plot_pose_;
-  bool is_simulation_;
+  ekf::FusionConfiguration fusion_config_;
+  CEkfFusionPtr fusion_;
   std::string frame_id_;
   std::string child_id_;
-  float min_speed_;
+
+  /**
+   * \brief filter output taken under alg_ and published by the callbacks after releasing it
+   */
+  struct FilterOutput
+  {
+    unsigned long version;
+    Eigen::Matrix<double, 3, 1> state;
+    Eigen::Matrix<double, 3, 3> covariance;
+    Eigen::Isometry3d map2odom;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  // counts the outputs under alg_, so that a late one does not replace a newer map -> odom
+  unsigned long filter_version_;
+  // guards what the callbacks publish outside alg_: the map -> odom hand-off, the checkpoint and
+  // the pose history
+  std::mutex output_mutex_;
+  unsigned long broadcast_version_;
+
+  // filter output written by the callbacks, published by mainNodeThread without alg_ lock
+  CStateSnapshot snapshot_;
+  unsigned long published_version_;
   geometry_msgs::PoseWithCovarianceStamped plot_pose_;
   geometry_msgs::PoseWithCovarianceStamped init_pose_;
-  geometry_msgs::TransformStamped odom_to_map_;
-  tf::TransformBroadcaster broadcaster_;
+  CTransformBroadcasterPtr tf_broadcaster_;
   tf::TransformListener listener_;
 
+  // latest map -> odom (own broadcast) and odom -> base_link (from /tf) transforms, behind their
+  // own lock so that the /tf messages do not wait on alg_
+  std::mutex tf_cache_mutex_;
+  CTransformCache tf_cache_;
+  size_t map2odom_edge_;
+  size_t odom2base_edge_;
+
+  // state and map -> odom saved on every filter change, to warm-start after a restart
+  CEkfCheckpoint checkpoint_;
+
+  // header stamp to output latency per input, including the alg_ lock wait
+  CLatencyHistogram odom_latency_;
+  CLatencyHistogram gnss_latency_;
+  CLatencyHistogram init_pose_latency_;
+  double latency_warning_;
+
+  // fused pose at the odometry stamps, for queries at past stamps
+  CPoseHistoryPtr pose_history_;
+
   // [publisher attributes]
   ros::Publisher plot_pose_pub_;
 
@@ -68,6 +109,7 @@ private:
   ros::Subscriber odom_gps_sub_;
   ros::Subscriber odom_raw_sub_;
   ros::Subscriber init_pose_sub_;
+  ros::Subscriber tf_sub_;
   
   /**
    * \brief callback for read initial pose messages
@@ -90,7 +132,45 @@ private:
    */
   void cb_getRawOdomMsg(const nav_msgs::Odometry::ConstPtr& odom_msg);
 
+  /**
+   * \brief callback for /tf messages, refreshes the transform cache
+   */
+  void cb_getTfMsg(const tf2_msgs::TFMessage::ConstPtr& tf_msg);
+
+  /**
+   * \brief latest odom -> base_link transform, from the cache or from the TF tree
+   * when the edge is not published directly on /tf
+   */
+  bool getOdomToBase(Eigen::Isometry3d& odom2base, const char* caller);
+
+  /**
+   * \brief lookup of the latest target <- source transform in the TF tree
+   * \return false (and a warning with the caller name) if it is not available
+   */
+  bool lookupTransform(const std::string& target, const std::string& source, Eigen::Isometry3d& transform,
+                       const char* caller);
+
+  /**
+   * \brief update and cache map -> odom with the latest odom -> base_link and copy
+   * the filter output, called with alg_ locked
+   */
+  void takeOutput(FilterOutput& output, const char* caller);
+
+  /**
+   * \brief hand the map -> odom transform to the broadcast thread and save the
+   * filter state in the checkpoint, called without alg_ (older outputs than the
+   * last one broadcast are dropped)
+   */
+  void broadcastMapToOdom(const FilterOutput& output);
+
   // [service attributes]
+  ros::ServiceServer get_pose_history_server_;
+
+  /**
+   * \brief service callback, fused pose at a batch of stamps (interpolated in
+   * the pose history)
+   */
+  bool get_pose_historyCallback(ekf_fusion::GetPoseHistory::Request &req, ekf_fusion::GetPoseHistory::Response &res);
 
   // [client attributes]
 
@@ -161,6 +241,12 @@ protected:
 
   // [diagnostic functions]
 
+  /**
+   * \brief p50/p99/max latency since the previous diagnostics update, warns
+   * when the p99 is over the latency_warning parameter
+   */
+  void latencyDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat, CLatencyHistogramPtr histogram);
+
   // [test functions]
 };
 
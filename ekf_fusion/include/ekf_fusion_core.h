@@ -0,0 +1,287 @@
+#ifndef _ekf_fusion_core_h_
+#define _ekf_fusion_core_h_
+
+#include <vector>
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include "ekf.h"
+#include "particle_filter.h"
+#include "ekf_replay_log.h"
+
+namespace ekf
+{
+
+struct OdomPose
+{
+  double stamp;
+  double x, y, theta;
+};
+
+struct GnssFix
+{
+  double stamp;
+  double x, y, theta;
+  double vx, vy;
+  double sigma_x, sigma_y, sigma_theta;
+};
+
+enum FilterType
+{
+  EKF_FILTER, PARTICLE_FILTER
+};
+
+struct FusionConfiguration
+{
+  double min_speed;
+  bool is_simulation;
+  size_t rewind_buffer_size; // filter steps kept to rewind delayed GNSS fixes (0 disables it)
+  double preintegration_rate; // [Hz] filter steps with the accumulated odometry (0 predicts every message)
+  FilterType filter_type;
+  ParticleFilterConfiguration particle_config; // only used by PARTICLE_FILTER
+};
+
+/**
+ * \brief Builds the GNSS observation, replacing the heading by the filter
+ * heading when the fix points backwards (rear direction protection)
+ */
+GnssObservation makeGnssObservation(const GnssFix& fix, const Eigen::Matrix<double, 3, 1>& state);
+
+/**
+ * \brief Builds the GNSS observation as received (for multimodal filters)
+ */
+GnssObservation makeGnssObservation(const GnssFix& fix);
+
+/**
+ * \brief Builds the odometry action between two odometry poses, with the
+ * displacement expressed in the map frame
+ */
+OdomAction makeOdomAction(const OdomPose& prev, const OdomPose& curr, const Eigen::Isometry3d& map2odom);
+
+/**
+ * \brief Computes map2odom from the filter state (map2base) and odom2base
+ *
+ * given: odom2base * map2odom = map2base
+ * then:  map2odom = map2base * odom2base^(-1)
+ */
+Eigen::Isometry3d composeMapToOdom(const Eigen::Matrix<double, 3, 1>& state, const Eigen::Isometry3d& odom2base);
+
+/**
+ * \brief Planar pose as a 3D isometry
+ */
+Eigen::Isometry3d poseToIsometry(double x, double y, double theta);
+}
+
+class CEkfFusion;
+typedef CEkfFusion* CEkfFusionPtr;
+
+/**
+ * \brief ROS-free fusion of odometry and GNSS around CEkf (or CParticleFilter)
+ *
+ * Holds the filter together with the bookkeeping the node callbacks used to
+ * keep in static variables (previous odometry pose, first GNSS fix) and the
+ * current map->odom transform. Frame lookups are left to the caller.
+ */
+class CEkfFusion
+{
+private:
+  /**
+   * \brief Filter step kept in the rewind buffer, with the state before applying it
+   */
+  struct HistoryEntry
+  {
+    bool is_gnss;
+    double stamp;
+    ekf::OdomAction act;
+    unsigned int steps; // odometry messages integrated in act
+    ekf::GnssFix fix;
+    Eigen::Matrix<double, 3, 1> state;
+    Eigen::Matrix<double, 3, 3> covariance;
+  };
+
+  CPoseFilterPtr filter_;
+  ekf::FusionConfiguration config_;
+
+  bool first_gnss_;
+  bool has_prev_odom_;
+  ekf::OdomPose prev_odom_;
+
+  // odometry pre-integrated since the last filter step
+  ekf::OdomAction pending_act_;
+  unsigned int pending_steps_;
+  double pending_stamp_;
+  double last_step_stamp_;
+
+  Eigen::Isometry3d map2odom_;
+
+  // time-sorted ring buffer of filter steps
+  std::vector<HistoryEntry> history_;
+  size_t history_head_;
+  size_t history_count_;
+  size_t late_gnss_count_;
+
+  HistoryEntry& historyAt(size_t index)
+  {
+    return history_[(history_head_ + index) % history_.size()];
+  }
+
+  void clearHistory(void)
+  {
+    history_head_ = 0;
+    history_count_ = 0;
+  }
+
+  /**
+   * \brief GNSS observation, with the rear direction protection if the filter needs it
+   */
+  ekf::GnssObservation makeObservation(const ekf::GnssFix& fix);
+
+  /**
+   * \brief Stores the current filter state in the entry (rewind buffer enabled) and applies the step
+   */
+  void applyEntry(HistoryEntry& entry);
+
+  /**
+   * \brief Inserts the entry at the given position, dropping the oldest one when full
+   * \return the position where the entry was finally stored
+   */
+  size_t insertHistory(size_t index, const HistoryEntry& entry);
+
+  /**
+   * \brief Applies the pre-integrated odometry as one filter step
+   */
+  void flushOdometry(void);
+
+  void clearPendingOdometry(void)
+  {
+    pending_act_.delta_x = 0.0;
+    pending_act_.delta_y = 0.0;
+    pending_act_.delta_theta = 0.0;
+    pending_act_.sigma_x = 0.0;
+    pending_act_.sigma_y = 0.0;
+    pending_act_.sigma_theta = 0.0;
+    pending_steps_ = 0;
+  }
+
+  /**
+   * \brief Rewinds to the fix stamp, updates there and replays the later steps
+   */
+  void rewindGnss(const ekf::GnssFix& fix);
+
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  CEkfFusion(ekf::KalmanConfiguration kalman_configuration, ekf::FusionConfiguration fusion_configuration);
+
+  ~CEkfFusion(void);
+
+  bool isInitialised(void)
+  {
+    return filter_->isInitialised();
+  }
+
+  /**
+   * \brief Manual relocation, keeps the current covariance
+   */
+  void setInitialPose(double x, double y, double theta);
+
+  /**
+   * \brief Warm start from a saved state (see CEkfCheckpoint), the filter is
+   * initialised without waiting for a GNSS fix
+   */
+  void restore(const Eigen::Matrix<double, 3, 1>& state, const Eigen::Matrix<double, 3, 3>& covariance,
+               const Eigen::Isometry3d& map2odom);
+
+  /**
+   * \brief Filter update with a GNSS fix
+   *
+   * When the fix is older than the last odometry step it is applied at its own
+   * stamp and the later steps are replayed (if the rewind buffer is enabled).
+   * \return false when the fix is discarded by the speed threshold
+   */
+  bool processGnss(const ekf::GnssFix& fix);
+
+  /**
+   * \brief Filter prediction with a new odometry pose (odom frame)
+   *
+   * With a pre-integration rate the displacements are accumulated and applied
+   * as one prediction (process noise once per message, the model is additive)
+   * every 1 / preintegration_rate seconds of odometry and before a GNSS update.
+   * \return true when a filter step was applied (false while the filter is not
+   * initialised or the odometry is being accumulated)
+   */
+  bool processOdometry(const ekf::OdomPose& odom, const Eigen::Isometry3d& map2odom);
+
+  /**
+   * \brief Recomputes map2odom from the current state and the given odom2base
+   */
+  const Eigen::Isometry3d& updateMapToOdom(const Eigen::Isometry3d& odom2base);
+
+  const Eigen::Isometry3d& getMapToOdom(void)
+  {
+    return map2odom_;
+  }
+
+  void getStateAndCovariance(Eigen::Matrix<double, 3, 1>& state, Eigen::Matrix<double, 3, 3>& covariance)
+  {
+    filter_->getStateAndCovariance(state, covariance);
+  }
+
+  /**
+   * \brief Number of delayed fixes older than the rewind buffer (applied at the current time)
+   */
+  size_t getLateGnssCount(void)
+  {
+    return late_gnss_count_;
+  }
+};
+
+class CReplayHook;
+typedef CReplayHook* CReplayHookPtr;
+
+/**
+ * \brief Per-step callback of CReplayDriver
+ */
+class CReplayHook
+{
+public:
+  virtual ~CReplayHook(void)
+  {
+  }
+
+  /**
+   * \brief Called after every event that changed the filter: an applied odometry
+   * step, an accepted GNSS fix or a relocation (event.type tells which), with
+   * map -> odom already updated
+   */
+  virtual void step(const ekf::ReplayEvent& event, CEkfFusion& fusion) = 0;
+};
+
+class CReplayDriver;
+typedef CReplayDriver* CReplayDriverPtr;
+
+/**
+ * \brief Feeds a recorded drive (see ekf_replay_log.h) to a CEkfFusion, one event
+ * at a time, as the node does with the /odom, /odometry_gps and /initialpose
+ * messages; the odometry pose is taken as the odom -> base_link transform
+ */
+class CReplayDriver
+{
+private:
+  CEkfFusion& fusion_;
+  CReplayHook& hook_;
+  Eigen::Isometry3d odom2base_;
+
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  CReplayDriver(CEkfFusion& fusion, CReplayHook& hook);
+
+  ~CReplayDriver(void);
+
+  /**
+   * \brief Applies the event to the filter, then calls the hook if it was a filter step
+   */
+  void apply(const ekf::ReplayEvent& event);
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef _ekf_replay_log_h_
+#define _ekf_replay_log_h_
+
+#include <cstdio>
+#include <string>
+
+namespace ekf
+{
+
+/**
+ * \brief One row of a recorded drive
+ *
+ * CSV layout (one event per line, '#' starts a comment, a first line starting
+ * with "stamp" is taken as header):
+ *   stamp,type,x,y,yaw,vx,vy,var_x,var_y,var_yaw
+ * type is "odom" (/odom pose in the odom frame), "gnss" (/odometry_gps) or
+ * "init" (/initialpose). Unused columns may be left empty.
+ */
+struct ReplayEvent
+{
+  enum Type
+  {
+    ODOM, GNSS, INIT
+  };
+
+  Type type;
+  double stamp;
+  double x, y, theta;
+  double vx, vy;
+  double var_x, var_y, var_theta;
+};
+}
+
+/**
+ * \brief Streaming reader for recorded drives, one event at a time
+ */
+class CReplayLogReader
+{
+private:
+  FILE* file_;
+  size_t line_number_;
+  size_t skipped_lines_;
+
+  bool parseLine(char* line, ekf::ReplayEvent& event);
+
+public:
+  CReplayLogReader(void);
+
+  ~CReplayLogReader(void);
+
+  bool open(const std::string& path);
+
+  void close(void);
+
+  /**
+   * \brief Reads the next valid event
+   * \return false at the end of the file
+   */
+  bool next(ekf::ReplayEvent& event);
+
+  size_t getSkippedLines(void)
+  {
+    return skipped_lines_;
+  }
+};
+
+#endif
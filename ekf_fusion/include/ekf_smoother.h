@@ -0,0 +1,100 @@
+#ifndef _ekf_smoother_h_
+#define _ekf_smoother_h_
+
+#include <vector>
+#include <Eigen/Dense>
+
+namespace ekf
+{
+
+struct SmoothedStep
+{
+  double stamp;
+  Eigen::Matrix<double, 3, 1> state;
+  Eigen::Matrix<double, 3, 3> covariance;
+};
+}
+
+class CEkfSmoother;
+typedef CEkfSmoother* CEkfSmootherPtr;
+
+/**
+ * \brief Rauch-Tung-Striebel smoother over the CEkf forward pass
+ *
+ * The forward pass reports every prediction (addStep) and the state after the
+ * GNSS updates that follow it (updateStep). Each step keeps its filtered and
+ * predicted state and the six unique entries of both covariances in one
+ * contiguous array (19 doubles per step), which the backward pass walks in
+ * reverse order:
+ *   C = P_f(k) * P_p(k+1)^-1
+ *   X_s(k) = X_f(k) + C * (X_s(k+1) - X_p(k+1))
+ *   P_s(k) = P_f(k) + C * (P_s(k+1) - P_p(k+1)) * C^T
+ * The CEkf motion model is additive, so the transition Jacobian is the
+ * identity and is not stored; the process noise of each step is implicit in
+ * P_p(k+1) - P_f(k).
+ *
+ * Memory is bounded: once chunk_size + lookahead steps are kept, the backward
+ * pass starts at the newest one (smoothed = filtered there) and the oldest
+ * chunk_size steps are emitted. The lookahead steps are kept for the next
+ * chunk, and must span enough GNSS updates for the smoothing gain of the
+ * unseen future to have vanished at the chunk boundary.
+ */
+class CEkfSmoother
+{
+private:
+  struct Step
+  {
+    double stamp;
+    double filtered[3];
+    double filtered_covariance[6]; // xx, xy, xt, yy, yt, tt
+    double predicted[3];
+    double predicted_covariance[6];
+  };
+
+  size_t chunk_size_;
+  size_t lookahead_;
+
+  std::vector<Step> steps_;
+  std::vector<ekf::SmoothedStep> output_;
+
+  /**
+   * \brief Backward pass over the kept steps, emits the oldest n_emit of them
+   */
+  void smooth(size_t n_emit);
+
+public:
+  CEkfSmoother(size_t chunk_size, size_t lookahead);
+
+  ~CEkfSmoother(void);
+
+  /**
+   * \brief New step after a prediction (filtered = predicted until updateStep)
+   */
+  void addStep(double stamp, const Eigen::Matrix<double, 3, 1>& state, const Eigen::Matrix<double, 3, 3>& covariance);
+
+  /**
+   * \brief State of the last step after a GNSS update
+   */
+  void updateStep(const Eigen::Matrix<double, 3, 1>& state, const Eigen::Matrix<double, 3, 3>& covariance);
+
+  /**
+   * \brief Smooths and emits all the kept steps; the next step starts a new
+   * segment (the filter was relocated or initialised again)
+   */
+  void endSegment(void);
+
+  /**
+   * \brief Smoothed steps emitted so far, in time order
+   */
+  const std::vector<ekf::SmoothedStep>& getOutput(void)
+  {
+    return output_;
+  }
+
+  void clearOutput(void)
+  {
+    output_.clear();
+  }
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef _ekf_state_snapshot_h_
+#define _ekf_state_snapshot_h_
+
+#include <atomic>
+#include <Eigen/Dense>
+
+namespace ekf
+{
+
+struct StateSnapshot
+{
+  unsigned long version; // number of writes, 0 while nothing was written
+  double stamp;
+  Eigen::Matrix<double, 3, 1> state;
+  Eigen::Matrix<double, 3, 3> covariance;
+};
+
+}
+
+/**
+ * \brief Latest filter output shared through a sequence lock
+ *
+ * One writer (the filter callbacks, already serialised) and any number of
+ * readers. The writer never waits; a reader retries only while a write is in
+ * progress, which is a handful of stores, so reading the pose never blocks on
+ * the filter work or the TF handling of the callbacks. The values are kept in
+ * relaxed atomics so the concurrent read is well defined.
+ */
+class CStateSnapshot
+{
+private:
+  static const int N_VALUES = 1 + 3 + 9;
+
+  std::atomic<unsigned long> sequence_;
+  std::atomic<double> values_[N_VALUES];
+
+public:
+  CStateSnapshot(void) :
+      sequence_(0)
+  {
+    for (int i = 0; i < N_VALUES; i++)
+      values_[i].store(0.0, std::memory_order_relaxed);
+  }
+
+  void write(double stamp, const Eigen::Matrix<double, 3, 1>& state, const Eigen::Matrix<double, 3, 3>& covariance)
+  {
+    unsigned long sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    values_[0].store(stamp, std::memory_order_relaxed);
+    for (int i = 0; i < 3; i++)
+      values_[1 + i].store(state(i), std::memory_order_relaxed);
+    for (int i = 0; i < 9; i++)
+      values_[4 + i].store(covariance(i), std::memory_order_relaxed);
+
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+  /**
+   * \brief Copies the latest consistent snapshot
+   * \return false if nothing has been written yet
+   */
+  bool read(ekf::StateSnapshot& snapshot) const
+  {
+    unsigned long before, after;
+    do
+    {
+      before = sequence_.load(std::memory_order_acquire);
+      snapshot.stamp = values_[0].load(std::memory_order_relaxed);
+      for (int i = 0; i < 3; i++)
+        snapshot.state(i) = values_[1 + i].load(std::memory_order_relaxed);
+      for (int i = 0; i < 9; i++)
+        snapshot.covariance(i) = values_[4 + i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = sequence_.load(std::memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+
+    snapshot.version = before / 2;
+    return snapshot.version != 0;
+  }
+
+  /**
+   * \brief Number of writes so far, to detect new snapshots without copying them
+   */
+  unsigned long getVersion(void) const
+  {
+    return sequence_.load(std::memory_order_acquire) / 2;
+  }
+};
+
+#endif
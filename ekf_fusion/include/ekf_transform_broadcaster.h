@@ -0,0 +1,68 @@
+#ifndef _ekf_transform_broadcaster_h_
+#define _ekf_transform_broadcaster_h_
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <ros/ros.h>
+#include <tf/transform_broadcaster.h>
+#include <Eigen/Geometry>
+
+class CTransformBroadcaster;
+typedef CTransformBroadcaster* CTransformBroadcasterPtr;
+
+/**
+ * \brief Rate-controlled map -> odom broadcaster running on its own thread
+ *
+ * The callbacks only hand over the latest transform; updates arriving between
+ * two ticks are coalesced and the thread sends the latest one at a fixed rate,
+ * stamped with the send time (the transform is also re-sent while it does not
+ * change, so listeners never extrapolate).
+ */
+class CTransformBroadcaster
+{
+private:
+  std::string frame_id_;
+  std::string child_id_;
+  double rate_;
+
+  std::mutex mutex_;
+  std::condition_variable stop_condition_;
+  bool stop_;
+  bool has_transform_;
+  size_t pending_updates_;
+  size_t coalesced_updates_;
+  Eigen::Isometry3d map2odom_;
+
+  tf::TransformBroadcaster broadcaster_;
+  std::thread thread_;
+
+  void broadcastThread(void);
+
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  /**
+   * \brief Starts the broadcast thread
+   * \param rate send rate [Hz]
+   */
+  CTransformBroadcaster(const std::string& frame_id, const std::string& child_id, double rate);
+
+  /**
+   * \brief Stops and joins the broadcast thread
+   */
+  ~CTransformBroadcaster(void);
+
+  /**
+   * \brief Replaces the transform sent on the next tick
+   */
+  void setMapToOdom(const Eigen::Isometry3d& map2odom);
+
+  /**
+   * \brief Number of updates replaced by a newer one before being sent
+   */
+  size_t getCoalescedUpdates(void);
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef _ekf_transform_cache_h_
+#define _ekf_transform_cache_h_
+
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+
+class CTransformCache;
+typedef CTransformCache* CTransformCachePtr;
+
+/**
+ * \brief Latest value of a few parent -> child transforms
+ *
+ * Replaces the TF queries of the node callbacks: the edges of interest are
+ * registered once, the cache is refreshed with every transform received on
+ * /tf (or set by the node itself), and the callbacks read the cached Eigen
+ * transform by edge index, without searching the TF tree or buffering history.
+ */
+class CTransformCache
+{
+private:
+  struct Edge
+  {
+    std::string parent;
+    std::string child;
+    bool valid;
+    double stamp;
+    Eigen::Isometry3d transform;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  // [s] a transform older than the cached one by more than this resets the edge
+  static const double CLOCK_RESET_THRESHOLD;
+
+  std::vector<Edge, Eigen::aligned_allocator<Edge> > edges_;
+
+  /**
+   * \brief Frame name without the leading '/' of tf1 names
+   */
+  static const char* frameName(const std::string& frame);
+
+public:
+  CTransformCache(void);
+
+  ~CTransformCache(void);
+
+  /**
+   * \brief Registers the parent -> child edge (parent <- child transform, as TF)
+   * \return the edge index used by the accessors
+   */
+  size_t addEdge(const std::string& parent, const std::string& child);
+
+  /**
+   * \brief Index of a registered edge, looked up by frame names
+   * \return false if the edge is not registered
+   */
+  bool findEdge(const std::string& parent, const std::string& child, size_t& edge) const;
+
+  /**
+   * \brief Stores the latest transform of the edge, late (older) stamps are ignored
+   */
+  void setTransform(size_t edge, double stamp, const Eigen::Isometry3d& transform);
+
+  /**
+   * \return false while no transform has been received for the edge
+   */
+  bool getTransform(size_t edge, Eigen::Isometry3d& transform) const
+  {
+    if (!edges_[edge].valid)
+      return false;
+    transform = edges_[edge].transform;
+    return true;
+  }
+
+  bool isValid(size_t edge) const
+  {
+    return edges_[edge].valid;
+  }
+
+  double getStamp(size_t edge) const
+  {
+    return edges_[edge].stamp;
+  }
+};
+
+#endif
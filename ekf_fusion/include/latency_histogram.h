@@ -0,0 +1,134 @@
+#ifndef _latency_histogram_h_
+#define _latency_histogram_h_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace ekf
+{
+
+struct LatencySummary
+{
+  uint64_t count;
+  double p50; // [s]
+  double p99; // [s]
+  double max; // [s]
+};
+
+}
+
+class CLatencyHistogram;
+typedef CLatencyHistogram* CLatencyHistogramPtr;
+
+/**
+ * \brief Lock-free latency histogram with HDR-style log-linear buckets
+ *
+ * Latencies are counted in microseconds: values under 2^SUB_BUCKET_BITS have
+ * their own bucket, larger ones fall in one of 2^(SUB_BUCKET_BITS - 1) linear
+ * buckets per power of two, so the percentiles have a relative error under
+ * 1 / 2^(SUB_BUCKET_BITS - 1) (1.6 %) up to 2^(MAX_MAGNITUDE + 1) us (134 s, larger
+ * values are clamped). record() is a couple of relaxed atomic operations, so
+ * the callbacks can record while the diagnostics thread collects.
+ */
+class CLatencyHistogram
+{
+private:
+  static const int SUB_BUCKET_BITS = 7;
+  static const int MAX_MAGNITUDE = 26;
+  static const uint64_t SUB_BUCKETS = 1ULL << SUB_BUCKET_BITS;
+  static const uint64_t HALF_SUB_BUCKETS = SUB_BUCKETS / 2;
+  static const uint64_t MAX_VALUE = (2ULL << MAX_MAGNITUDE) - 1;
+  static const size_t N_BUCKETS = (MAX_MAGNITUDE - SUB_BUCKET_BITS + 3) * HALF_SUB_BUCKETS;
+
+  std::atomic<uint64_t> counts_[N_BUCKETS];
+  std::atomic<uint64_t> max_;
+
+  // counts taken by collect()
+  uint64_t collected_[N_BUCKETS];
+
+  static size_t bucketIndex(uint64_t value)
+  {
+    if (value < SUB_BUCKETS)
+      return value;
+    int magnitude = 63 - __builtin_clzll(value);
+    int shift = magnitude - SUB_BUCKET_BITS + 1;
+    return shift * HALF_SUB_BUCKETS + (value >> shift);
+  }
+
+  /**
+   * \brief Largest value counted in the bucket
+   */
+  static uint64_t bucketValue(size_t index)
+  {
+    if (index < SUB_BUCKETS)
+      return index;
+    int shift = index / HALF_SUB_BUCKETS - 1;
+    uint64_t sub_bucket = index % HALF_SUB_BUCKETS + HALF_SUB_BUCKETS;
+    return ((sub_bucket + 1) << shift) - 1;
+  }
+
+public:
+  CLatencyHistogram(void) :
+      max_(0)
+  {
+    for (size_t i = 0; i < N_BUCKETS; i++)
+      counts_[i].store(0, std::memory_order_relaxed);
+  }
+
+  /**
+   * \param latency [s], negative values (clock offsets between hosts) count as 0
+   */
+  void record(double latency)
+  {
+    uint64_t value = 0;
+    if (latency > 0.0)
+      value = latency * 1e6 < MAX_VALUE ? static_cast<uint64_t>(latency * 1e6) : MAX_VALUE;
+
+    counts_[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed))
+      ;
+  }
+
+  /**
+   * \brief Summary of the latencies recorded since the previous call, which are cleared
+   *
+   * Counts recorded concurrently go either to this summary or to the next one.
+   */
+  void collect(ekf::LatencySummary& summary)
+  {
+    summary.count = 0;
+    for (size_t i = 0; i < N_BUCKETS; i++)
+    {
+      collected_[i] = counts_[i].exchange(0, std::memory_order_relaxed);
+      summary.count += collected_[i];
+    }
+    summary.max = max_.exchange(0, std::memory_order_relaxed) * 1e-6;
+
+    summary.p50 = 0.0;
+    summary.p99 = 0.0;
+    uint64_t rank50 = (summary.count + 1) / 2;
+    uint64_t rank99 = summary.count - summary.count / 100;
+    uint64_t accumulated = 0;
+    for (size_t i = 0; i < N_BUCKETS && accumulated < rank99; i++)
+    {
+      if (collected_[i] == 0)
+        continue;
+      bool below50 = accumulated < rank50;
+      accumulated += collected_[i];
+      if (below50 && accumulated >= rank50)
+        summary.p50 = bucketValue(i) * 1e-6;
+      if (accumulated >= rank99)
+        summary.p99 = bucketValue(i) * 1e-6;
+    }
+
+    // the bucket bound may be over the largest value actually recorded
+    if (summary.p50 > summary.max)
+      summary.p50 = summary.max;
+    if (summary.p99 > summary.max)
+      summary.p99 = summary.max;
+  }
+};
+
+#endif
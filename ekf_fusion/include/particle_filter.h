@@ -0,0 +1,140 @@
+#ifndef _particle_filter_h_
+#define _particle_filter_h_
+
+#include <random>
+#include <vector>
+#include <Eigen/Dense>
+#include "ekf.h"
+#include "thread_pool.h"
+
+namespace ekf
+{
+
+struct ParticleFilterConfiguration
+{
+  size_t n_particles;
+  size_t n_threads; // threads running the kernels (1 runs them on the calling thread)
+  double resampling_threshold; // resample when the effective sample size drops below this fraction
+  double reverse_heading_weight; // weight of the GNSS heading flipped by PI in the likelihood
+};
+}
+
+class CParticleFilter;
+typedef CParticleFilter* CParticleFilterPtr;
+
+/**
+ * \brief Particle filter over the 2D pose, alternative backend to CEkf
+ *
+ * Uses the same motion and observation models as CEkf (additive map-frame
+ * displacement with the x/y/theta model noise, GNSS pose with its variances),
+ * but the GNSS heading likelihood is a mixture of the heading and its reverse,
+ * so a fix pointing backwards keeps both hypotheses instead of being replaced
+ * by the filter heading.
+ *
+ * Particles are stored as structure-of-arrays lanes and the motion and
+ * likelihood kernels are Eigen array expressions over them (vectorised), split
+ * in chunks over an optional thread pool. Gaussian noise is read from a table
+ * filled at construction at a random offset per prediction, so no random
+ * numbers are drawn per particle. Resampling is systematic and only done when
+ * the effective sample size drops below the threshold.
+ */
+class CParticleFilter : public CPoseFilter
+{
+private:
+  typedef std::vector<double, Eigen::aligned_allocator<double> > Lane;
+  typedef Eigen::Map<Eigen::ArrayXd> LaneMap;
+
+  static const size_t NOISE_TABLE_SIZE = 1 << 16;
+
+  ekf::KalmanConfiguration config_;
+  ekf::ParticleFilterConfiguration particle_config_;
+
+  bool initialised_;
+  size_t size_;
+
+  // particle lanes and normalised weights
+  Lane x_, y_, theta_, weight_;
+
+  // resampling destination lanes (scratch lanes for the kernels) and per particle log-likelihood
+  Lane x_new_, y_new_, theta_new_, log_likelihood_;
+
+  // standard normal samples, NOISE_TABLE_SIZE + size_ long
+  Lane noise_;
+  std::mt19937_64 random_;
+
+  // cached Gaussian summary
+  bool summary_valid_;
+  Eigen::Matrix<double, 3, 1> mean_;
+  Eigen::Matrix<double, 3, 3> covariance_;
+
+  CThreadPoolPtr pool_;
+  size_t n_chunks_;
+  std::vector<double> chunk_values_;
+
+  size_t chunkBegin(size_t chunk)
+  {
+    // chunk boundaries on multiples of 4 particles (packet size)
+    return ((size_ * chunk / n_chunks_) / 4) * 4;
+  }
+
+  size_t chunkEnd(size_t chunk)
+  {
+    return chunk + 1 == n_chunks_ ? size_ : chunkBegin(chunk + 1);
+  }
+
+  size_t noiseOffset(void);
+
+  /**
+   * \brief Draws the particles from a Gaussian with uniform weights
+   */
+  void sample(const Eigen::Matrix<double, 3, 1>& mean, const Eigen::Matrix<double, 3, 3>& covariance);
+
+  void updateSummary(void);
+
+  void resample(void);
+
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  CParticleFilter(ekf::KalmanConfiguration kalman_configuration,
+                  ekf::ParticleFilterConfiguration particle_configuration);
+
+  ~CParticleFilter(void);
+
+  bool isInitialised(void)
+  {
+    return initialised_;
+  }
+
+  void setInitialised(bool initialised)
+  {
+    initialised_ = initialised;
+  }
+
+  void predict(ekf::OdomAction act, unsigned int n_steps = 1);
+
+  /**
+   * \brief Reweights the particles with the GNSS likelihood; the fix is discarded
+   * when its Mahalanobis distance to the Gaussian summary is over the outlier threshold
+   */
+  double update(ekf::GnssObservation obs);
+
+  void getStateAndCovariance(Eigen::Matrix<double, 3, 1>& state, Eigen::Matrix<double, 3, 3>& covariance);
+
+  /**
+   * \brief Replaces the particles by samples of the given Gaussian
+   */
+  void setStateAndCovariance(Eigen::Matrix<double, 3, 1> state, Eigen::Matrix<double, 3, 3> covariance);
+
+  bool needsHeadingProtection(void)
+  {
+    return false;
+  }
+
+  /**
+   * \brief Effective sample size 1 / sum(w^2)
+   */
+  double getEffectiveSampleSize(void);
+};
+
+#endif
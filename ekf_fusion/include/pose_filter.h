@@ -0,0 +1,68 @@
+#ifndef _pose_filter_h_
+#define _pose_filter_h_
+
+#include <Eigen/Dense>
+
+namespace ekf
+{
+
+struct GnssObservation
+{
+  double x, y, theta;
+  double sigma_x, sigma_y, sigma_theta;
+};
+
+struct OdomAction
+{
+  double delta_x, delta_y, delta_theta;
+  double sigma_x, sigma_y, sigma_theta;
+};
+}
+
+class CPoseFilter;
+typedef CPoseFilter* CPoseFilterPtr;
+
+/**
+ * \brief Interface of the 2D pose (x, y, theta) filters used by CEkfFusion
+ *
+ * The odometry action is a displacement in the map frame and the GNSS
+ * observation a full pose, whatever the filter representation.
+ */
+class CPoseFilter
+{
+public:
+  virtual ~CPoseFilter(void)
+  {
+  }
+
+  virtual bool isInitialised(void) = 0;
+
+  virtual void setInitialised(bool initialised) = 0;
+
+  /**
+   * \brief Prediction with the displacement of n_steps odometry steps (pre-integrated),
+   * the process noise is added once per step
+   */
+  virtual void predict(ekf::OdomAction act, unsigned int n_steps = 1) = 0;
+
+  /**
+   * \brief Update with a GNSS fix, initialises the filter on the fix if it is not initialised
+   * \return the observation likelihood
+   */
+  virtual double update(ekf::GnssObservation obs) = 0;
+
+  /**
+   * \brief Gaussian summary of the estimate
+   */
+  virtual void getStateAndCovariance(Eigen::Matrix<double, 3, 1>& state, Eigen::Matrix<double, 3, 3>& covariance) = 0;
+
+  virtual void setStateAndCovariance(Eigen::Matrix<double, 3, 1> state, Eigen::Matrix<double, 3, 3> covariance) = 0;
+
+  /**
+   * \brief Whether a GNSS heading pointing backwards must be replaced before the
+   * update (rear direction protection), i.e. the filter is unimodal
+   */
+  virtual bool needsHeadingProtection(void) = 0;
+};
+
+#endif
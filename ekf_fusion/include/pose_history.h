@@ -0,0 +1,85 @@
+#ifndef _pose_history_h_
+#define _pose_history_h_
+
+#include <stddef.h>
+#include <vector>
+
+namespace ekf
+{
+
+struct Pose2D
+{
+  double x, y, theta;
+};
+
+}
+
+class CPoseHistory;
+typedef CPoseHistory* CPoseHistoryPtr;
+
+/**
+ * \brief Bounded, time-sorted history of the fused pose
+ *
+ * The samples are kept in a preallocated ring buffer (one contiguous vector,
+ * no allocation once full, the oldest sample is overwritten). A query does a
+ * binary search on the stamps, O(log n), and interpolates on the SE(2)
+ * geodesic between the two samples around the stamp (constant velocity and
+ * yaw rate along the step). Stamps outside the kept interval are not
+ * extrapolated.
+ */
+class CPoseHistory
+{
+private:
+  struct Sample
+  {
+    double stamp;
+    ekf::Pose2D pose;
+  };
+
+  // [s] a sample older than the newest one by more than this clears the history (clock reset)
+  static const double CLOCK_RESET_THRESHOLD;
+
+  std::vector<Sample> samples_;
+  size_t head_;
+  size_t count_;
+
+  const Sample& sampleAt(size_t index) const
+  {
+    return samples_[(head_ + index) % samples_.size()];
+  }
+
+  /**
+   * \brief Pose at the given fraction of the SE(2) step from start to end
+   */
+  static ekf::Pose2D interpolate(const ekf::Pose2D& start, const ekf::Pose2D& end, double fraction);
+
+public:
+  CPoseHistory(size_t capacity);
+
+  ~CPoseHistory(void);
+
+  /**
+   * \brief Appends a pose; a sample with the stamp of the newest one replaces it
+   * and a slightly older one (out of order) is dropped
+   */
+  void add(double stamp, const ekf::Pose2D& pose);
+
+  void clear(void)
+  {
+    head_ = 0;
+    count_ = 0;
+  }
+
+  size_t size(void) const
+  {
+    return count_;
+  }
+
+  /**
+   * \brief Pose at the given stamp
+   * \return false if the stamp is outside the kept history
+   */
+  bool getPose(double stamp, ekf::Pose2D& pose) const;
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef _thread_pool_h_
+#define _thread_pool_h_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class CThreadPool;
+typedef CThreadPool* CThreadPoolPtr;
+
+/**
+ * \brief Fixed set of worker threads running indexed tasks in parallel
+ *
+ * run() hands the tasks [0, n_tasks) to the workers and to the calling thread,
+ * and returns when all of them are done. The task is passed by reference and
+ * called through a plain function pointer, so dispatching does not allocate.
+ */
+class CThreadPool
+{
+private:
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable start_condition_;
+  std::condition_variable done_condition_;
+  unsigned long generation_;
+  bool stop_;
+
+  void (*call_)(void* task, size_t index);
+  void* task_;
+  size_t n_tasks_;
+  std::atomic<size_t> next_task_;
+  size_t pending_workers_;
+
+  template<class Task>
+    static void callTask(void* task, size_t index)
+    {
+      (*static_cast<Task*>(task))(index);
+    }
+
+  void runTasks(void)
+  {
+    size_t index;
+    while ((index = next_task_.fetch_add(1, std::memory_order_relaxed)) < n_tasks_)
+      call_(task_, index);
+  }
+
+  void workerThread(void)
+  {
+    unsigned long generation = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+      start_condition_.wait(lock, [&]
+      { return stop_ || generation_ != generation;});
+      if (stop_)
+        return;
+      generation = generation_;
+
+      lock.unlock();
+      runTasks();
+      lock.lock();
+
+      if (--pending_workers_ == 0)
+        done_condition_.notify_one();
+    }
+  }
+
+public:
+  /**
+   * \param n_threads threads running the tasks, including the calling one
+   */
+  CThreadPool(size_t n_threads) :
+      generation_(0), stop_(false), call_(NULL), task_(NULL), n_tasks_(0), next_task_(0), pending_workers_(0)
+  {
+    for (size_t i = 1; i < n_threads; i++)
+      workers_.push_back(std::thread(&CThreadPool::workerThread, this));
+  }
+
+  ~CThreadPool(void)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    start_condition_.notify_all();
+    for (size_t i = 0; i < workers_.size(); i++)
+      workers_[i].join();
+  }
+
+  size_t size(void)
+  {
+    return workers_.size() + 1;
+  }
+
+  /**
+   * \brief Calls task(index) for every index in [0, n_tasks), blocking until all are done
+   */
+  template<class Task>
+    void run(size_t n_tasks, Task& task)
+    {
+      if (workers_.empty())
+      {
+        for (size_t i = 0; i < n_tasks; i++)
+          task(i);
+        return;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        call_ = &CThreadPool::callTask<Task>;
+        task_ = &task;
+        n_tasks_ = n_tasks;
+        next_task_.store(0, std::memory_order_relaxed);
+        pending_workers_ = workers_.size();
+        generation_++;
+      }
+      start_condition_.notify_all();
+
+      runTasks();
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_condition_.wait(lock, [this]
+      { return pending_workers_ == 0;});
+    }
+};
+
+#endif
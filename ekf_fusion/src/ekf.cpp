@@ -8,41 +8,23 @@ CEkf::CEkf(ekf::KalmanConfiguration kalman_configuration)
   debug_ = false;
 
   //State vector
-  X_(0, 0) = 0.0;
-  X_(1, 0) = 0.0;
-  X_(2, 0) = 0.0;
+  engine_.state().setZero();
 
   // State covariance matrix
-  P_(0, 0) = pow(config_.x_ini, 2); // initial value for x variance;
-  P_(0, 1) = 0.0;
-  P_(0, 2) = 0.0;
-
-  P_(1, 0) = 0.0;
-  P_(1, 1) = pow(config_.y_ini, 2); // y variance
-  P_(1, 2) = 0.0;
-
-  P_(2, 0) = 0.0;
-  P_(2, 1) = 0.0;
-  P_(2, 2) = pow(config_.theta_ini, 2); // orientation variance
+  Eigen::Matrix<double, 3, 3>& P = engine_.covariance();
+  P.setZero();
+  P(0, 0) = pow(config_.x_ini, 2); // initial value for x variance;
+  P(1, 1) = pow(config_.y_ini, 2); // y variance
+  P(2, 2) = pow(config_.theta_ini, 2); // orientation variance
 
   // Model noise covariance matrix
-  Q_(0, 0) = pow(config_.x_model, 2.0); //x noise variance
-  Q_(0, 1) = 0.0;
-  Q_(0, 2) = 0.0;
-
-  Q_(1, 0) = 0.0;
-  Q_(1, 1) = pow(config_.y_model, 2.0); //y  noise variance
-  Q_(1, 2) = 0.0;
-
-  Q_(2, 0) = 0.0;
-  Q_(2, 1) = 0.0;
-  Q_(2, 2) = pow(config_.theta_model, 2.0); //theta  noise variance
-
-  // Identity matrix
-  F_X_.setIdentity();
-  F_q_.setIdentity();
-  F_u_.setIdentity();
-  H_.setIdentity();
+  Eigen::Matrix<double, 3, 3> Q = Eigen::Matrix<double, 3, 3>::Zero();
+  Q(0, 0) = pow(config_.x_model, 2.0); //x noise variance
+  Q(1, 1) = pow(config_.y_model, 2.0); //y  noise variance
+  Q(2, 2) = pow(config_.theta_model, 2.0); //theta  noise variance
+  engine_.setProcessNoise(Q);
+
+  // F_X, F_u, F_q and H are identity (ekf::IdentityStructure)
 }
 
 CEkf::~CEkf(void)
@@ -50,49 +32,42 @@ CEkf::~CEkf(void)
 
 }
 
-void CEkf::predict(ekf::OdomAction act)
+void CEkf::predict(ekf::OdomAction act, unsigned int n_steps)
 {
-  static bool first_exec = true;
-  static double t_last = 0.0;
-  double dt = 0.0;
-
   if (flag_ekf_initialised_)
   {
-    // State prediction
-    Eigen::Matrix<double, 3, 1> u = Eigen::Matrix<double, 3, 1>::Zero();
-
+    // State and covariance prediction
+    Eigen::Matrix<double, 3, 1> u;
     u(0) = act.delta_x;
     u(1) = act.delta_y;
     u(2) = act.delta_theta;
-    X_(0) = X_(0) + u(0);
-    X_(1) = X_(1) + u(1);
-    X_(2) = X_(2) + u(2);
+    engine_.predict(u, static_cast<double>(n_steps));
 
     //angle correction
-    if (X_(2) > PI)
-      X_(2) = X_(2) - 2 * PI;
-    else if (X_(2) < -1 * PI)
-      X_(2) = X_(2) + 2 * PI;
-
-    // Covariance prediction
-    P_ = F_X_ * P_ * F_X_.transpose() + F_q_ * Q_ * F_q_.transpose();
+    Eigen::Matrix<double, 3, 1>& X = engine_.state();
+    if (X(2) > PI)
+      X(2) = X(2) - 2 * PI;
+    else if (X(2) < -1 * PI)
+      X(2) = X(2) + 2 * PI;
   }
 }
 
 double CEkf::update(ekf::GnssObservation obs)
 {
   const double INVALID_DISTANCE = -1.0;
-  double mahalanobis_distance = INVALID_DISTANCE;
   double likelihood = INVALID_DISTANCE;
 
+  Eigen::Matrix<double, 3, 1>& X = engine_.state();
+
   if (!flag_ekf_initialised_)
   {
-    X_(0) = obs.x;
-    X_(1) = obs.y;
-    X_(2) = obs.theta;
-    P_(0, 0) = obs.sigma_x; // initial value for x variance;
-    P_(1, 1) = obs.sigma_y; // initial value for y variance
-    P_(2, 2) = obs.sigma_theta; // initial value for orientation variance
+    Eigen::Matrix<double, 3, 3>& P = engine_.covariance();
+    X(0) = obs.x;
+    X(1) = obs.y;
+    X(2) = obs.theta;
+    P(0, 0) = obs.sigma_x; // initial value for x variance;
+    P(1, 1) = obs.sigma_y; // initial value for y variance
+    P(2, 2) = obs.sigma_theta; // initial value for orientation variance
   }
   else
   {
@@ -103,14 +78,11 @@ double CEkf::update(ekf::GnssObservation obs)
     y(2) = obs.theta;
 
     // Expectation
-    Eigen::Matrix<double, 3, 1> e, z; // expectation, innovation
-    e(0) = X_(0);
-    e(1) = X_(1);
-    e(2) = X_(2);
+    Eigen::Matrix<double, 3, 1> e = X;
 
     //for differential problems
-    float diff = y(2) - e(2);
-    if (abs(diff) > PI)
+    double diff = y(2) - e(2);
+    if (fabs(diff) > PI)
     {
       if (e(2) <= 0.0)
         e(2) = e(2) + 2 * PI;
@@ -119,71 +91,47 @@ double CEkf::update(ekf::GnssObservation obs)
     }
 
     // Innovation
-    z = y - e;
+    Eigen::Matrix<double, 3, 1> z = y - e;
 
-    // Innovation covariance
+    // Observation noise
     Eigen::Matrix<double, 3, 3> R = Eigen::Matrix<double, 3, 3>::Zero();
-
     R(0, 0) = obs.sigma_x;
     R(1, 1) = obs.sigma_y;
     R(2, 2) = obs.sigma_theta;
 
-    Eigen::Matrix<double, 3, 3> Z = Eigen::Matrix<double, 3, 3>::Zero();
-
-    Z = H_ * P_ * H_.transpose() + R;
-
     if (debug_)
       std::cout << "CEkf::Update R: " << R << std::endl;
 
-    mahalanobis_distance = sqrt(z.transpose() * Z.inverse() * z);
-
-    likelihood = exp(-0.5 * mahalanobis_distance) / sqrt(Z.determinant());
+    ekf::UpdateResult result = engine_.update(z, R, config_.outlier_mahalanobis_threshold);
+    likelihood = result.likelihood;
 
     if (debug_)
-      std::cout << "CEkf::Update mahalanobis_distance: " << mahalanobis_distance << std::endl;
-
-    if (mahalanobis_distance < config_.outlier_mahalanobis_threshold)
     {
-      // Kalman gain
-      Eigen::Matrix<double, 3, 3> K = Eigen::Matrix<double, 3, 3>::Zero();
-      K = P_ * H_.transpose() * Z.inverse();
-
-      if (debug_)
-        std::cout << "CEkf::Update K: " << K << std::endl;
-
-      // State correction
-      X_ = X_ + K * z;
-
-      if (debug_)
-        std::cout << "CEkf::Update X_: " << X_ << std::endl;
-
-      // State covariance correction
-      //P_ = P_ - K * Z * K.transpose();
-      // State covariance correction (Joseph form)
-      Eigen::Matrix<double, 3, 3> I = Eigen::Matrix<double, 3, 3>::Identity();
-      P_ = (I - K * H_) * P_;
-
-      if (debug_)
-        std::cout << "CEkf::Update P_: " << P_ << std::endl;
+      std::cout << "CEkf::Update mahalanobis_distance: " << result.mahalanobis_distance << std::endl;
+      if (result.accepted)
+      {
+        std::cout << "CEkf::Update X_: " << X << std::endl;
+        std::cout << "CEkf::Update P_: " << engine_.covariance() << std::endl;
+      }
     }
 
     //angle correction
-    if (X_(2) > PI)
-      X_(2) = X_(2) - 2 * PI;
-    else if (X_(2) < -1 * PI)
-      X_(2) = X_(2) + 2 * PI;
+    if (X(2) > PI)
+      X(2) = X(2) - 2 * PI;
+    else if (X(2) < -1 * PI)
+      X(2) = X(2) + 2 * PI;
   }
   return (likelihood);
 }
 
 void CEkf::getStateAndCovariance(Eigen::Matrix<double, 3, 1> &state, Eigen::Matrix<double, 3, 3> &covariance)
 {
-  state = X_;
-  covariance = P_;
+  state = engine_.state();
+  covariance = engine_.covariance();
 }
 
 void CEkf::setStateAndCovariance(Eigen::Matrix<double, 3, 1> state, Eigen::Matrix<double, 3, 3> covariance)
 {
-  X_ = state;
-  P_ = covariance;
+  engine_.state() = state;
+  engine_.covariance() = covariance;
 }
@@ -0,0 +1,127 @@
+#include "ekf_checkpoint.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// "EKFCKPT1", the last character is the record layout version
+const uint64_t CEkfCheckpoint::MAGIC = 0x3154504b43464b45ULL;
+
+namespace
+{
+
+double wallTime(void)
+{
+  return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+}
+
+CEkfCheckpoint::CEkfCheckpoint(void)
+{
+  fd_ = -1;
+  record_ = NULL;
+}
+
+CEkfCheckpoint::~CEkfCheckpoint(void)
+{
+  close();
+}
+
+bool CEkfCheckpoint::open(const std::string& path)
+{
+  close();
+
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd_ < 0)
+    return false;
+
+  // a new (or truncated) file is zero filled, i.e. without a valid record
+  struct stat file_stat;
+  if (fstat(fd_, &file_stat) != 0
+      || (file_stat.st_size < static_cast<off_t>(sizeof(Record)) && ftruncate(fd_, sizeof(Record)) != 0))
+  {
+    close();
+    return false;
+  }
+
+  void* mapping = mmap(NULL, sizeof(Record), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (mapping == MAP_FAILED)
+  {
+    close();
+    return false;
+  }
+  record_ = static_cast<Record*>(mapping);
+  return true;
+}
+
+void CEkfCheckpoint::close(void)
+{
+  if (record_ != NULL)
+  {
+    munmap(record_, sizeof(Record));
+    record_ = NULL;
+  }
+  if (fd_ >= 0)
+  {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool CEkfCheckpoint::load(ekf::CheckpointData& data, double max_age)
+{
+  if (record_ == NULL || record_->magic != MAGIC || (record_->sequence & 1) != 0)
+    return false;
+
+  data.wall_time = record_->wall_time;
+  double age = wallTime() - data.wall_time;
+  if (!(age >= 0.0 && age <= max_age))
+    return false;
+
+  for (int i = 0; i < 3; i++)
+    data.state(i) = record_->state[i];
+  for (int i = 0; i < 9; i++)
+    data.covariance(i) = record_->covariance[i];
+  Eigen::Quaterniond rotation(record_->rotation[3], record_->rotation[0], record_->rotation[1], record_->rotation[2]);
+  data.map2odom.setIdentity();
+  data.map2odom.linear() = rotation.normalized().toRotationMatrix();
+  data.map2odom.translation() = Eigen::Vector3d(record_->translation[0], record_->translation[1],
+                                                record_->translation[2]);
+
+  return data.state.allFinite() && data.covariance.allFinite() && data.map2odom.matrix().allFinite();
+}
+
+void CEkfCheckpoint::store(const Eigen::Matrix<double, 3, 1>& state, const Eigen::Matrix<double, 3, 3>& covariance,
+                           const Eigen::Isometry3d& map2odom)
+{
+  if (record_ == NULL)
+    return;
+
+  // the stores only have to stay in program order (the page survives a crash of
+  // this process, and it is only read at start-up), a compiler fence is enough
+  uint64_t sequence = record_->sequence | 1;
+  record_->sequence = sequence;
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+
+  record_->wall_time = wallTime();
+  for (int i = 0; i < 3; i++)
+    record_->state[i] = state(i);
+  for (int i = 0; i < 9; i++)
+    record_->covariance[i] = covariance(i);
+  Eigen::Quaterniond rotation(map2odom.linear());
+  record_->rotation[0] = rotation.x();
+  record_->rotation[1] = rotation.y();
+  record_->rotation[2] = rotation.z();
+  record_->rotation[3] = rotation.w();
+  for (int i = 0; i < 3; i++)
+    record_->translation[i] = map2odom.translation()(i);
+  record_->magic = MAGIC;
+
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  record_->sequence = sequence + 1;
+}
@@ -0,0 +1,303 @@
+#include "ekf_filter_bank.h"
+
+CEkfFilterBank::CEkfFilterBank(ekf::KalmanConfiguration kalman_configuration, size_t n_vehicles)
+{
+  config_ = kalman_configuration;
+  size_ = n_vehicles;
+
+  // Model noise covariance matrix (diagonal)
+  q_xx_ = pow(config_.x_model, 2.0);
+  q_yy_ = pow(config_.y_model, 2.0);
+  q_tt_ = pow(config_.theta_model, 2.0);
+
+  active_.assign(size_, 0.0);
+
+  x_.assign(size_, 0.0);
+  y_.assign(size_, 0.0);
+  theta_.assign(size_, 0.0);
+
+  p_xx_.assign(size_, pow(config_.x_ini, 2));
+  p_xy_.assign(size_, 0.0);
+  p_xt_.assign(size_, 0.0);
+  p_yy_.assign(size_, pow(config_.y_ini, 2));
+  p_yt_.assign(size_, 0.0);
+  p_tt_.assign(size_, pow(config_.theta_ini, 2));
+
+  batch_mark_.assign(size_, 0);
+  batch_counter_ = 0;
+}
+
+CEkfFilterBank::~CEkfFilterBank(void)
+{
+
+}
+
+void CEkfFilterBank::predict(size_t id, const ekf::OdomAction& act)
+{
+  if (active_[id] == 0.0)
+    return;
+
+  x_[id] += act.delta_x;
+  y_[id] += act.delta_y;
+  theta_[id] += act.delta_theta;
+
+  //angle correction
+  if (theta_[id] > PI)
+    theta_[id] -= 2 * PI;
+  else if (theta_[id] < -1 * PI)
+    theta_[id] += 2 * PI;
+
+  p_xx_[id] += q_xx_;
+  p_yy_[id] += q_yy_;
+  p_tt_[id] += q_tt_;
+}
+
+void CEkfFilterBank::predictAll(const double* delta_x, const double* delta_y, const double* delta_theta)
+{
+  typedef Eigen::Map<const Packet, Eigen::Unaligned> ConstPacketMap;
+  const Packet q_xx = Packet::Constant(q_xx_);
+  const Packet q_yy = Packet::Constant(q_yy_);
+  const Packet q_tt = Packet::Constant(q_tt_);
+
+  size_t i = 0;
+  for (; i + PACKET_SIZE <= size_; i += PACKET_SIZE)
+  {
+    // branch-free: inactive vehicles are masked out
+    Packet m = Packet::Map(&active_[i]);
+    Packet::Map(&x_[i]) += m * ConstPacketMap(delta_x + i);
+    Packet::Map(&y_[i]) += m * ConstPacketMap(delta_y + i);
+    Packet t = Packet::Map(&theta_[i]) + m * ConstPacketMap(delta_theta + i);
+    t -= (t > PI).cast<double>() * (2 * PI);
+    t += (t < -PI).cast<double>() * (2 * PI);
+    Packet::Map(&theta_[i]) = t;
+    Packet::Map(&p_xx_[i]) += m * q_xx;
+    Packet::Map(&p_yy_[i]) += m * q_yy;
+    Packet::Map(&p_tt_[i]) += m * q_tt;
+  }
+  for (; i < size_; i++)
+  {
+    ekf::OdomAction act = {delta_x[i], delta_y[i], delta_theta[i], 0.0, 0.0, 0.0};
+    predict(i, act);
+  }
+}
+
+double CEkfFilterBank::update(size_t id, const ekf::GnssObservation& obs)
+{
+  double likelihood;
+  updateBatch(&id, &obs, 1, &likelihood);
+  return likelihood;
+}
+
+void CEkfFilterBank::innovation(size_t id, const ekf::GnssObservation& obs, double& z_x, double& z_y, double& z_t)
+{
+  double y_t = obs.theta;
+  double e_t = theta_[id];
+
+  //for differential problems
+  double diff = y_t - e_t;
+  if (fabs(diff) > PI)
+  {
+    if (e_t <= 0.0)
+      e_t = e_t + 2 * PI;
+    else if (obs.theta <= 0.0)
+      y_t = y_t + 2 * PI;
+  }
+
+  z_x = obs.x - x_[id];
+  z_y = obs.y - y_[id];
+  z_t = y_t - e_t;
+}
+
+void CEkfFilterBank::updateBatch(const size_t* ids, const ekf::GnssObservation* obs, size_t n, double* likelihoods)
+{
+  const double INVALID_DISTANCE = -1.0;
+
+  if (s_x_.size() < n)
+  {
+    size_t padded = (n + PACKET_SIZE - 1) / PACKET_SIZE * PACKET_SIZE;
+    Lane* lanes[] = {&s_x_, &s_y_, &s_t_, &s_xx_, &s_xy_, &s_xt_, &s_yy_, &s_yt_, &s_tt_, &z_x_, &z_y_, &z_t_,
+                     &r_xx_, &r_yy_, &r_tt_, &likelihood_};
+    for (size_t l = 0; l < sizeof(lanes) / sizeof(lanes[0]); l++)
+      lanes[l]->resize(padded);
+  }
+  // not tied to the lanes: they are padded, so they may already hold n entries when these do not
+  if (batch_ids_.size() < n)
+  {
+    batch_ids_.resize(n);
+    batch_index_.resize(n);
+  }
+
+  size_t staged = 0;
+  for (size_t k = 0; k <= n; k++)
+  {
+    // flush when a vehicle repeats in the batch or at the end
+    bool flush = k == n || batch_mark_[ids[k]] == batch_counter_ + 1;
+    if (flush && staged > 0)
+    {
+      updateKernel(staged);
+      for (size_t i = 0; i < staged; i++)
+      {
+        size_t id = batch_ids_[i];
+        x_[id] = s_x_[i];
+        y_[id] = s_y_[i];
+        theta_[id] = s_t_[i];
+        p_xx_[id] = s_xx_[i];
+        p_xy_[id] = s_xy_[i];
+        p_xt_[id] = s_xt_[i];
+        p_yy_[id] = s_yy_[i];
+        p_yt_[id] = s_yt_[i];
+        p_tt_[id] = s_tt_[i];
+        likelihoods[batch_index_[i]] = likelihood_[i];
+      }
+      staged = 0;
+      batch_counter_++;
+      if (batch_counter_ + 1 == 0)
+      {
+        batch_mark_.assign(size_, 0);
+        batch_counter_ = 0;
+      }
+    }
+    if (k == n)
+      break;
+
+    size_t id = ids[k];
+    const ekf::GnssObservation& o = obs[k];
+
+    if (active_[id] == 0.0)
+    {
+      x_[id] = o.x;
+      y_[id] = o.y;
+      theta_[id] = o.theta;
+      p_xx_[id] = o.sigma_x; // initial value for x variance;
+      p_yy_[id] = o.sigma_y; // initial value for y variance
+      p_tt_[id] = o.sigma_theta; // initial value for orientation variance
+      likelihoods[k] = INVALID_DISTANCE;
+      continue;
+    }
+
+    // gather
+    batch_mark_[id] = batch_counter_ + 1;
+    batch_ids_[staged] = id;
+    batch_index_[staged] = k;
+    s_x_[staged] = x_[id];
+    s_y_[staged] = y_[id];
+    s_t_[staged] = theta_[id];
+    s_xx_[staged] = p_xx_[id];
+    s_xy_[staged] = p_xy_[id];
+    s_xt_[staged] = p_xt_[id];
+    s_yy_[staged] = p_yy_[id];
+    s_yt_[staged] = p_yt_[id];
+    s_tt_[staged] = p_tt_[id];
+    innovation(id, o, z_x_[staged], z_y_[staged], z_t_[staged]);
+    r_xx_[staged] = o.sigma_x;
+    r_yy_[staged] = o.sigma_y;
+    r_tt_[staged] = o.sigma_theta;
+    staged++;
+  }
+}
+
+void CEkfFilterBank::updateKernel(size_t n)
+{
+  const double gate = config_.outlier_mahalanobis_threshold;
+
+  // the staging lanes are padded to a multiple of the packet size
+  for (size_t i = n; i % PACKET_SIZE != 0; i++)
+  {
+    s_xx_[i] = s_yy_[i] = s_tt_[i] = 1.0;
+    s_xy_[i] = s_xt_[i] = s_yt_[i] = 0.0;
+    z_x_[i] = z_y_[i] = z_t_[i] = 0.0;
+    r_xx_[i] = r_yy_[i] = r_tt_[i] = 0.0;
+    s_x_[i] = s_y_[i] = s_t_[i] = 0.0;
+  }
+
+  for (size_t i = 0; i < n; i += PACKET_SIZE)
+  {
+    Packet pxx = Packet::Map(&s_xx_[i]), pxy = Packet::Map(&s_xy_[i]), pxt = Packet::Map(&s_xt_[i]);
+    Packet pyy = Packet::Map(&s_yy_[i]), pyt = Packet::Map(&s_yt_[i]);
+    Packet ptt = Packet::Map(&s_tt_[i]);
+    Packet zx = Packet::Map(&z_x_[i]), zy = Packet::Map(&z_y_[i]), zt = Packet::Map(&z_t_[i]);
+
+    // Innovation covariance Z = P + R
+    Packet z00 = pxx + Packet::Map(&r_xx_[i]), z01 = pxy, z02 = pxt;
+    Packet z11 = pyy + Packet::Map(&r_yy_[i]), z12 = pyt;
+    Packet z22 = ptt + Packet::Map(&r_tt_[i]);
+
+    // LDLT of Z
+    Packet d0 = z00;
+    Packet l10 = z01 / d0;
+    Packet l20 = z02 / d0;
+    Packet d1 = z11 - l10 * z01;
+    Packet l21 = (z12 - l20 * z01) / d1;
+    Packet d2 = z22 - l20 * z02 - l21 * l21 * d1;
+
+    // Mahalanobis distance and likelihood
+    Packet w0 = zx;
+    Packet w1 = zy - l10 * w0;
+    Packet w2 = zt - l20 * w0 - l21 * w1;
+    Packet det = d0 * d1 * d2;
+    Packet mahalanobis_distance = (w0 * w0 / d0 + w1 * w1 / d1 + w2 * w2 / d2).sqrt();
+    Packet::Map(&likelihood_[i]) = (-0.5 * mahalanobis_distance).exp() / det.sqrt();
+    Packet a = (mahalanobis_distance < gate).cast<double>();
+
+    // Z^-1
+    Packet inv_det = det.inverse();
+    Packet i00 = (z11 * z22 - z12 * z12) * inv_det;
+    Packet i01 = (z02 * z12 - z01 * z22) * inv_det;
+    Packet i02 = (z01 * z12 - z02 * z11) * inv_det;
+    Packet i11 = (z00 * z22 - z02 * z02) * inv_det;
+    Packet i12 = (z01 * z02 - z00 * z12) * inv_det;
+    Packet i22 = (z00 * z11 - z01 * z01) * inv_det;
+
+    // Kalman gain K = P * Z^-1, masked by the gate
+    Packet k00 = a * (pxx * i00 + pxy * i01 + pxt * i02);
+    Packet k01 = a * (pxx * i01 + pxy * i11 + pxt * i12);
+    Packet k02 = a * (pxx * i02 + pxy * i12 + pxt * i22);
+    Packet k10 = a * (pxy * i00 + pyy * i01 + pyt * i02);
+    Packet k11 = a * (pxy * i01 + pyy * i11 + pyt * i12);
+    Packet k12 = a * (pxy * i02 + pyy * i12 + pyt * i22);
+    Packet k20 = a * (pxt * i00 + pyt * i01 + ptt * i02);
+    Packet k21 = a * (pxt * i01 + pyt * i11 + ptt * i12);
+    Packet k22 = a * (pxt * i02 + pyt * i12 + ptt * i22);
+
+    // State correction
+    Packet::Map(&s_x_[i]) += k00 * zx + k01 * zy + k02 * zt;
+    Packet::Map(&s_y_[i]) += k10 * zx + k11 * zy + k12 * zt;
+    Packet th = Packet::Map(&s_t_[i]) + k20 * zx + k21 * zy + k22 * zt;
+
+    //angle correction
+    th -= (th > PI).cast<double>() * (2 * PI);
+    th += (th < -PI).cast<double>() * (2 * PI);
+    Packet::Map(&s_t_[i]) = th;
+
+    // State covariance correction P = P - K * P
+    Packet::Map(&s_xx_[i]) = pxx - (k00 * pxx + k01 * pxy + k02 * pxt);
+    Packet::Map(&s_xy_[i]) = pxy - (k00 * pxy + k01 * pyy + k02 * pyt);
+    Packet::Map(&s_xt_[i]) = pxt - (k00 * pxt + k01 * pyt + k02 * ptt);
+    Packet::Map(&s_yy_[i]) = pyy - (k10 * pxy + k11 * pyy + k12 * pyt);
+    Packet::Map(&s_yt_[i]) = pyt - (k10 * pxt + k11 * pyt + k12 * ptt);
+    Packet::Map(&s_tt_[i]) = ptt - (k20 * pxt + k21 * pyt + k22 * ptt);
+  }
+}
+
+void CEkfFilterBank::getStateAndCovariance(size_t id, Eigen::Matrix<double, 3, 1>& state,
+                                           Eigen::Matrix<double, 3, 3>& covariance)
+{
+  state << x_[id], y_[id], theta_[id];
+  covariance << p_xx_[id], p_xy_[id], p_xt_[id],
+                p_xy_[id], p_yy_[id], p_yt_[id],
+                p_xt_[id], p_yt_[id], p_tt_[id];
+}
+
+void CEkfFilterBank::setStateAndCovariance(size_t id, const Eigen::Matrix<double, 3, 1>& state,
+                                           const Eigen::Matrix<double, 3, 3>& covariance)
+{
+  x_[id] = state(0);
+  y_[id] = state(1);
+  theta_[id] = state(2);
+  p_xx_[id] = covariance(0, 0);
+  p_xy_[id] = covariance(0, 1);
+  p_xt_[id] = covariance(0, 2);
+  p_yy_[id] = covariance(1, 1);
+  p_yt_[id] = covariance(1, 2);
+  p_tt_[id] = covariance(2, 2);
+}
@@ -6,7 +6,11 @@ EkfFusionAlgNode::EkfFusionAlgNode(void) :
 
   //init class attributes if necessary
   //this->loop_rate_ = 10; //in [Hz]
-  this->flag_plot_pose_ = false;
+  this->published_version_ = 0;
+  this->filter_version_ = 0;
+  this->broadcast_version_ = 0;
+  this->fusion_config_.min_speed = 0.0;
+  this->fusion_config_.is_simulation = false;
   this->public_node_handle_.getParam("/ekf_fusion/frame_id", this->frame_id_);
   this->public_node_handle_.getParam("/ekf_fusion/child_id", this->child_id_);
   this->public_node_handle_.getParam("/ekf_fusion/x_model", this->kalman_config_.x_model);
@@ -14,10 +18,61 @@ EkfFusionAlgNode::EkfFusionAlgNode(void) :
   this->public_node_handle_.getParam("/ekf_fusion/theta_model", this->kalman_config_.theta_model);
   this->public_node_handle_.getParam("/ekf_fusion/outlier_mahalanobis",
                                      this->kalman_config_.outlier_mahalanobis_threshold);
-  this->public_node_handle_.getParam("/ekf_fusion/min_speed", this->min_speed_);
-  this->public_node_handle_.getParam("/ekf_fusion/is_simulation", this->is_simulation_);
-
-  this->ekf_ = new CEkf(this->kalman_config_);
+  this->public_node_handle_.getParam("/ekf_fusion/min_speed", this->fusion_config_.min_speed);
+  this->public_node_handle_.getParam("/ekf_fusion/is_simulation", this->fusion_config_.is_simulation);
+  int rewind_buffer_size = 100;
+  this->public_node_handle_.getParam("/ekf_fusion/rewind_buffer_size", rewind_buffer_size);
+  this->fusion_config_.rewind_buffer_size = rewind_buffer_size > 0 ? rewind_buffer_size : 0;
+  this->fusion_config_.preintegration_rate = 0.0;
+  this->public_node_handle_.getParam("/ekf_fusion/preintegration_rate", this->fusion_config_.preintegration_rate);
+  std::string filter = "ekf";
+  int particles = 10000;
+  int particle_threads = 1;
+  this->public_node_handle_.getParam("/ekf_fusion/filter", filter);
+  this->public_node_handle_.getParam("/ekf_fusion/particles", particles);
+  this->public_node_handle_.getParam("/ekf_fusion/particle_threads", particle_threads);
+  this->fusion_config_.filter_type = filter == "particle" ? ekf::PARTICLE_FILTER : ekf::EKF_FILTER;
+  this->fusion_config_.particle_config.n_particles = particles > 0 ? particles : 1;
+  this->fusion_config_.particle_config.n_threads = particle_threads > 0 ? particle_threads : 1;
+  this->fusion_config_.particle_config.resampling_threshold = 0.5;
+  this->fusion_config_.particle_config.reverse_heading_weight = 0.1;
+  this->public_node_handle_.getParam("/ekf_fusion/reverse_heading_weight",
+                                     this->fusion_config_.particle_config.reverse_heading_weight);
+  double tf_rate = 50.0;
+  this->public_node_handle_.getParam("/ekf_fusion/tf_rate", tf_rate);
+  std::string checkpoint_file = "";
+  double checkpoint_max_age = 5.0;
+  int pose_history_size = 2000;
+  this->public_node_handle_.getParam("/ekf_fusion/pose_history_size", pose_history_size);
+  this->latency_warning_ = 0.1;
+  this->public_node_handle_.getParam("/ekf_fusion/latency_warning", this->latency_warning_);
+  this->public_node_handle_.getParam("/ekf_fusion/checkpoint_file", checkpoint_file);
+  this->public_node_handle_.getParam("/ekf_fusion/checkpoint_max_age", checkpoint_max_age);
+
+  this->fusion_ = new CEkfFusion(this->kalman_config_, this->fusion_config_);
+  this->pose_history_ = new CPoseHistory(pose_history_size > 0 ? pose_history_size : 1);
+
+  this->map2odom_edge_ = this->tf_cache_.addEdge(this->frame_id_, this->child_id_);
+  this->odom2base_edge_ = this->tf_cache_.addEdge(this->child_id_, "base_link");
+  this->tf_broadcaster_ = new CTransformBroadcaster(this->frame_id_, this->child_id_, tf_rate);
+
+  ///// warm start from the last checkpoint if it is recent enough
+  if (!checkpoint_file.empty())
+  {
+    ekf::CheckpointData checkpoint;
+    if (!this->checkpoint_.open(checkpoint_file))
+      ROS_WARN("[ekf_fusion] can not open checkpoint file %s", checkpoint_file.c_str());
+    else if (this->checkpoint_.load(checkpoint, checkpoint_max_age))
+    {
+      this->fusion_->restore(checkpoint.state, checkpoint.covariance, checkpoint.map2odom);
+      this->snapshot_.write(ros::Time::now().toSec(), checkpoint.state, checkpoint.covariance);
+      // not through broadcastMapToOdom: storing it would stamp the restored record as fresh, and a node
+      // restarting faster than checkpoint_max_age would keep restoring it; only a filter step stores
+      this->tf_cache_.setTransform(this->map2odom_edge_, ros::Time::now().toSec(), checkpoint.map2odom);
+      this->tf_broadcaster_->setMapToOdom(checkpoint.map2odom);
+      ROS_INFO("[ekf_fusion] restored state from checkpoint %s", checkpoint_file.c_str());
+    }
+  }
 
   // [init publishers]
   this->plot_pose_pub_ = this->public_node_handle_.advertise < geometry_msgs::PoseWithCovarianceStamped
@@ -29,8 +84,11 @@ EkfFusionAlgNode::EkfFusionAlgNode(void) :
   this->odom_gps_sub_ = this->public_node_handle_.subscribe("/odometry_gps", 1, &EkfFusionAlgNode::cb_getGpsOdomMsg,
                                                             this);
   this->odom_raw_sub_ = this->public_node_handle_.subscribe("/odom", 1, &EkfFusionAlgNode::cb_getRawOdomMsg, this);
+  this->tf_sub_ = this->public_node_handle_.subscribe("/tf", 100, &EkfFusionAlgNode::cb_getTfMsg, this);
 
   // [init services]
+  this->get_pose_history_server_ = this->public_node_handle_.advertiseService(
+      "/ekf_fusion/get_pose_history", &EkfFusionAlgNode::get_pose_historyCallback, this);
 
   // [init clients]
 
@@ -42,6 +100,9 @@ EkfFusionAlgNode::EkfFusionAlgNode(void) :
 EkfFusionAlgNode::~EkfFusionAlgNode(void)
 {
   // [free dynamic memory]
+  delete this->tf_broadcaster_;
+  delete this->pose_history_;
+  delete this->fusion_;
 }
 
 void EkfFusionAlgNode::mainNodeThread(void)
@@ -53,19 +114,38 @@ void EkfFusionAlgNode::mainNodeThread(void)
   // [fill action structure and make request to the action server]
 
   // [publish messages]
-  if (this->flag_plot_pose_)
+  if (this->snapshot_.getVersion() != this->published_version_)
   {
+    ekf::StateSnapshot snapshot;
+    this->snapshot_.read(snapshot);
+
+    this->plot_pose_.header.stamp = ros::Time(snapshot.stamp);
+    this->plot_pose_.header.frame_id = this->frame_id_;
+    tf::Quaternion quaternion = tf::createQuaternionFromRPY(0, 0, snapshot.state(2));
+    this->plot_pose_.pose.pose.position.x = snapshot.state(0);
+    this->plot_pose_.pose.pose.position.y = snapshot.state(1);
+    this->plot_pose_.pose.pose.orientation.x = quaternion[0];
+    this->plot_pose_.pose.pose.orientation.y = quaternion[1];
+    this->plot_pose_.pose.pose.orientation.z = quaternion[2];
+    this->plot_pose_.pose.pose.orientation.w = quaternion[3];
+    this->plot_pose_.pose.covariance[0] = snapshot.covariance(0, 0);
+    this->plot_pose_.pose.covariance[7] = snapshot.covariance(1, 1);
+    this->plot_pose_.pose.covariance[14] = 1000000000000.0;
+    this->plot_pose_.pose.covariance[35] = snapshot.covariance(2, 2);
     this->plot_pose_pub_.publish(this->plot_pose_);
-    this->flag_plot_pose_ = false;
+    this->published_version_ = snapshot.version;
   }
 }
 
 /*  [subscriber callbacks] */
 void EkfFusionAlgNode::cb_getInitPoseMsg(const geometry_msgs::PoseWithCovarianceStamped::ConstPtr &init_msg)
 {
+  FilterOutput output;
+  bool has_output = false;
+
   this->alg_.lock();
 
-  if (this->ekf_->flag_ekf_initialised_)
+  if (this->fusion_->isInitialised())
   {
     //get yaw information
     tf::Quaternion q(init_msg->pose.pose.orientation.x, init_msg->pose.pose.orientation.y,
@@ -75,340 +155,240 @@ void EkfFusionAlgNode::cb_getInitPoseMsg(const geometry_msgs::PoseWithCovariance
     m.getRPY(roll, pitch, yaw);
 
     // set manual state
-    Eigen::Matrix<double, 3, 1> state;
-    Eigen::Matrix<double, 3, 3> covariance;
-    this->ekf_->getStateAndCovariance(state, covariance);
-    state(0) = init_msg->pose.pose.position.x;
-    state(1) = init_msg->pose.pose.position.y;
-    state(2) = yaw;
-    this->ekf_->setStateAndCovariance(state, covariance);
-
-    ////////////////////////////////////////////////////////////////////////////////
-    ///// generate frame -> child transform
-    tf::Quaternion quaternion = tf::createQuaternionFromRPY(0, 0, state(2));
-    tf::StampedTransform tf_odom2base;
-    try
-    {
-      this->listener_.lookupTransform(this->child_id_, "base_link", ros::Time(0), tf_odom2base);
-    }
-    catch (tf::TransformException &ex)
-    {
-      ROS_WARN("[draw_frames] TF exception cb_getInitPoseMsg:\n%s", ex.what());
-    }
+    this->fusion_->setInitialPose(init_msg->pose.pose.position.x, init_msg->pose.pose.position.y, yaw);
 
-    // generate 4x4 transform matrix odom2base
-    Eigen::Affine3d af_odom2base;
-    tf::transformTFToEigen(tf_odom2base, af_odom2base);
-    Eigen::Matrix4d tr_odom2base;
-    tr_odom2base.setIdentity();
-    tr_odom2base.block<3, 3>(0, 0) = af_odom2base.linear();
-    tr_odom2base.block<3, 1>(0, 3) = af_odom2base.translation();
-
-    // generate 4x4 transform matrix map2base
-    Eigen::Matrix4d tr_map2base;
-    tr_map2base.setIdentity();
-    Eigen::Quaterniond rot(quaternion[3], quaternion[0], quaternion[1], quaternion[2]);
-    tr_map2base.block<3, 3>(0, 0) = rot.toRotationMatrix();
-    tr_map2base.block<3, 1>(0, 3) = Eigen::Vector3d(state(0), state(1), 0.0);
-
-    // given: odom2base * map2odom = map2base
-    // thenn: map2odom = map2base * odom2base^(-1)
-    Eigen::Matrix4d tr_map2odom;
-    tr_map2odom = tr_map2base * tr_odom2base.inverse();
-
-    Eigen::Quaterniond quat_final(tr_map2odom.block<3, 3>(0, 0));
-
-    this->odom_to_map_.header.frame_id = this->frame_id_;
-    this->odom_to_map_.child_frame_id = this->child_id_;
-    this->odom_to_map_.header.stamp = ros::Time::now();
-    this->odom_to_map_.transform.translation.x = tr_map2odom(0, 3);
-    this->odom_to_map_.transform.translation.y = tr_map2odom(1, 3);
-    this->odom_to_map_.transform.translation.z = tr_map2odom(2, 3);
-    this->odom_to_map_.transform.rotation.x = quat_final.x();
-    this->odom_to_map_.transform.rotation.y = quat_final.y();
-    this->odom_to_map_.transform.rotation.z = quat_final.z();
-    this->odom_to_map_.transform.rotation.w = quat_final.w();
-
-    this->broadcaster_.sendTransform(this->odom_to_map_);
-    ////////////////////////////////////////////////////////////////////////////////
+    this->takeOutput(output, "cb_getInitPoseMsg");
+    has_output = true;
   }
 
   this->alg_.unlock();
+
+  if (has_output)
+  {
+    this->broadcastMapToOdom(output);
+
+    // some tools send the pose without stamp
+    if (!init_msg->header.stamp.isZero())
+      this->init_pose_latency_.record((ros::Time::now() - init_msg->header.stamp).toSec());
+  }
 }
 
 void EkfFusionAlgNode::cb_getGpsOdomMsg(const nav_msgs::Odometry::ConstPtr &odom_msg)
 {
+  //get yaw information
+  tf::Quaternion q(odom_msg->pose.pose.orientation.x, odom_msg->pose.pose.orientation.y,
+                   odom_msg->pose.pose.orientation.z, odom_msg->pose.pose.orientation.w);
+  tf::Matrix3x3 m(q);
+  double roll, pitch, yaw;
+  m.getRPY(roll, pitch, yaw);
+
+  // set observation
+  ekf::GnssFix fix;
+  fix.stamp = odom_msg->header.stamp.toSec();
+  fix.x = odom_msg->pose.pose.position.x;
+  fix.y = odom_msg->pose.pose.position.y;
+  fix.theta = yaw;
+  fix.vx = odom_msg->twist.twist.linear.x;
+  fix.vy = odom_msg->twist.twist.linear.y;
+  fix.sigma_x = odom_msg->pose.covariance[0];
+  fix.sigma_y = odom_msg->pose.covariance[7];
+  fix.sigma_theta = odom_msg->pose.covariance[35];
+
+  FilterOutput output;
+  bool has_output = false;
+
   this->alg_.lock();
 
-  static int first_exec = true;
+  if (this->fusion_->processGnss(fix))
+  {
+    this->takeOutput(output, "cb_getGpsOdomMsg");
+    has_output = true;
+  }
 
-  double vx = odom_msg->twist.twist.linear.x;
-  double vy = odom_msg->twist.twist.linear.y;
-  double speed = sqrt(vx * vx + vy * vy);
+  this->alg_.unlock();
 
-  if (speed > this->min_speed_ || (this->is_simulation_ && first_exec))
+  if (has_output)
   {
+    this->broadcastMapToOdom(output);
+    this->gnss_latency_.record((ros::Time::now() - odom_msg->header.stamp).toSec());
+  }
+}
 
-    ekf::GnssObservation obs;
+void EkfFusionAlgNode::cb_getRawOdomMsg(const nav_msgs::Odometry::ConstPtr &odom_msg)
+{
+  //get yaw information
+  double roll, pitch, yaw;
+  tf::Quaternion q(odom_msg->pose.pose.orientation.x, odom_msg->pose.pose.orientation.y,
+                   odom_msg->pose.pose.orientation.z, odom_msg->pose.pose.orientation.w);
+  tf::Matrix3x3 m(q);
+  m.getRPY(roll, pitch, yaw);
+
+  ekf::OdomPose odom;
+  odom.stamp = odom_msg->header.stamp.toSec();
+  odom.x = odom_msg->pose.pose.position.x;
+  odom.y = odom_msg->pose.pose.position.y;
+  odom.theta = yaw;
+
+  FilterOutput output;
+  bool has_output = false;
+
+  // only the filter step holds alg_, it is shared with the GNSS fixes that rewind and replay it
+  this->alg_.lock();
 
-    //get yaw information
-    tf::Quaternion q(odom_msg->pose.pose.orientation.x, odom_msg->pose.pose.orientation.y,
-                     odom_msg->pose.pose.orientation.z, odom_msg->pose.pose.orientation.w);
-    tf::Matrix3x3 m(q);
-    double roll, pitch, yaw;
-    m.getRPY(roll, pitch, yaw);
+  ///// odometry displacement is expressed in the TF frame
+  Eigen::Isometry3d map2odom;
+  bool has_map2odom;
+  {
+    std::lock_guard<std::mutex> lock(this->tf_cache_mutex_);
+    has_map2odom = this->tf_cache_.getTransform(this->map2odom_edge_, map2odom);
+  }
 
-    // set observation
-    obs.x = odom_msg->pose.pose.position.x;
-    obs.y = odom_msg->pose.pose.position.y;
-    obs.theta = yaw;
-    obs.sigma_x = odom_msg->pose.covariance[0];
-    obs.sigma_y = odom_msg->pose.covariance[7];
-    obs.sigma_theta = odom_msg->pose.covariance[35];
-
-    // state lecture
-    Eigen::Matrix<double, 3, 1> state;
-    Eigen::Matrix<double, 3, 3> covariance;
-    this->ekf_->getStateAndCovariance(state, covariance);
-
-    // rear direction protection
-    float diff = state(2) - obs.theta;
-    if (abs(diff) > PI)
-    {
-      if (state(2) <= 0.0)
-        diff = (state(2) + 2 * PI) - obs.theta;
-      else if (obs.theta <= 0.0)
-        diff = state(2) - (obs.theta + 2 * PI);
-    }
-    if (abs(diff) > PI / 2)
-    {
-      obs.theta = state(2);
-    }
+  // while the odometry is pre-integrated the filter (and so map -> odom) does not change
+  if (this->fusion_->isInitialised() && has_map2odom && this->fusion_->processOdometry(odom, map2odom))
+  {
+    this->takeOutput(output, "cb_getRawOdomMsg");
+    has_output = true;
+  }
 
-    this->ekf_->update(obs);
+  this->alg_.unlock();
 
-    ////////////////////////////////////////////////////////////////////////////////
-    ///// generate frame -> child transform
-    this->ekf_->getStateAndCovariance(state, covariance);
-    tf::Quaternion quaternion = tf::createQuaternionFromRPY(0, 0, state(2));
-    tf::StampedTransform tf_odom2base;
-    try
-    {
-      this->listener_.lookupTransform(this->child_id_, "base_link", ros::Time(0), tf_odom2base);
-    }
-    catch (tf::TransformException &ex)
+  if (has_output)
+  {
+    ///// publish the output for plot (read by mainNodeThread without the lock)
+    this->snapshot_.write(odom.stamp, output.state, output.covariance);
+
+    ///// keep it for the pose history queries
+    ekf::Pose2D pose;
+    pose.x = output.state(0);
+    pose.y = output.state(1);
+    pose.theta = output.state(2);
     {
-      ROS_WARN("[draw_frames] TF exception cb_getGpsOdomMsg:\n%s", ex.what());
+      std::lock_guard<std::mutex> lock(this->output_mutex_);
+      this->pose_history_->add(odom.stamp, pose);
     }
 
-    // generate 4x4 transform matrix odom2base
-    Eigen::Affine3d af_odom2base;
-    tf::transformTFToEigen(tf_odom2base, af_odom2base);
-    Eigen::Matrix4d tr_odom2base;
-    tr_odom2base.setIdentity();
-    tr_odom2base.block<3, 3>(0, 0) = af_odom2base.linear();
-    tr_odom2base.block<3, 1>(0, 3) = af_odom2base.translation();
-
-    // generate 4x4 transform matrix map2base
-    Eigen::Matrix4d tr_map2base;
-    tr_map2base.setIdentity();
-    Eigen::Quaterniond rot(quaternion[3], quaternion[0], quaternion[1], quaternion[2]);
-    tr_map2base.block<3, 3>(0, 0) = rot.toRotationMatrix();
-    tr_map2base.block<3, 1>(0, 3) = Eigen::Vector3d(state(0), state(1), 0.0);
-
-    // given: odom2base * map2odom = map2base
-    // thenn: map2odom = map2base * odom2base^(-1)
-    Eigen::Matrix4d tr_map2odom;
-    tr_map2odom = tr_map2base * tr_odom2base.inverse();
-
-    Eigen::Quaterniond quat_final(tr_map2odom.block<3, 3>(0, 0));
-
-    this->odom_to_map_.header.frame_id = this->frame_id_;
-    this->odom_to_map_.child_frame_id = this->child_id_;
-    this->odom_to_map_.header.stamp = ros::Time::now();
-    this->odom_to_map_.transform.translation.x = tr_map2odom(0, 3);
-    this->odom_to_map_.transform.translation.y = tr_map2odom(1, 3);
-    this->odom_to_map_.transform.translation.z = tr_map2odom(2, 3);
-    this->odom_to_map_.transform.rotation.x = quat_final.x();
-    this->odom_to_map_.transform.rotation.y = quat_final.y();
-    this->odom_to_map_.transform.rotation.z = quat_final.z();
-    this->odom_to_map_.transform.rotation.w = quat_final.w();
-
-    this->broadcaster_.sendTransform(this->odom_to_map_);
-    ////////////////////////////////////////////////////////////////////////////////
-
-    this->ekf_->flag_ekf_initialised_ = true;
-    first_exec = false;
+    this->broadcastMapToOdom(output);
 
+    this->odom_latency_.record((ros::Time::now() - odom_msg->header.stamp).toSec());
   }
+}
 
-  this->alg_.unlock();
+void EkfFusionAlgNode::cb_getTfMsg(const tf2_msgs::TFMessage::ConstPtr &tf_msg)
+{
+  for (size_t i = 0; i < tf_msg->transforms.size(); i++)
+  {
+    const geometry_msgs::TransformStamped& transform = tf_msg->transforms[i];
+    size_t edge;
+    if (!this->tf_cache_.findEdge(transform.header.frame_id, transform.child_frame_id, edge))
+      continue;
+
+    // map -> odom is cached by takeOutput, the echo of a send can carry an older estimate
+    if (edge == this->map2odom_edge_)
+      continue;
+
+    Eigen::Affine3d affine;
+    tf::transformMsgToEigen(transform.transform, affine);
+    Eigen::Isometry3d isometry;
+    isometry.linear() = affine.linear();
+    isometry.translation() = affine.translation();
+    isometry.makeAffine();
+
+    std::lock_guard<std::mutex> lock(this->tf_cache_mutex_);
+    this->tf_cache_.setTransform(edge, transform.header.stamp.toSec(), isometry);
+  }
 }
 
-void EkfFusionAlgNode::cb_getRawOdomMsg(const nav_msgs::Odometry::ConstPtr &odom_msg)
+bool EkfFusionAlgNode::getOdomToBase(Eigen::Isometry3d& odom2base, const char* caller)
 {
-  this->alg_.lock();
+  {
+    std::lock_guard<std::mutex> lock(this->tf_cache_mutex_);
+    if (this->tf_cache_.getTransform(this->odom2base_edge_, odom2base))
+      return true;
+  }
+
+  // the odom -> base_link edge is not (yet) on /tf, e.g. it goes through intermediate frames
+  ROS_WARN_ONCE("[ekf_fusion] %s -> base_link not received on /tf, falling back to TF lookups",
+                this->child_id_.c_str());
+  return this->lookupTransform(this->child_id_, "base_link", odom2base, caller);
+}
 
-  if (this->ekf_->flag_ekf_initialised_)
+bool EkfFusionAlgNode::lookupTransform(const std::string& target, const std::string& source,
+                                       Eigen::Isometry3d& transform, const char* caller)
+{
+  tf::StampedTransform tf_transform;
+  tf_transform.setIdentity();
+  bool found = true;
+  try
+  {
+    this->listener_.lookupTransform(target, source, ros::Time(0), tf_transform);
+  }
+  catch (tf::TransformException &ex)
   {
+    ROS_WARN("[draw_frames] TF exception %s:\n%s", caller, ex.what());
+    found = false;
+  }
 
-    this->odom_to_map_.header.stamp = ros::Time::now();
-    this->broadcaster_.sendTransform(this->odom_to_map_);
+  Eigen::Affine3d affine;
+  tf::transformTFToEigen(tf_transform, affine);
+  transform.linear() = affine.linear();
+  transform.translation() = affine.translation();
+  transform.makeAffine();
+  return found;
+}
 
-    double yaw_frame, x_frame, y_frame;
-    double yaw_frame_prev, x_frame_prev, y_frame_prev;
-    double roll, pitch, yaw, yaw_use;
-    //get yaw information
-    tf::Quaternion q(odom_msg->pose.pose.orientation.x, odom_msg->pose.pose.orientation.y,
-                     odom_msg->pose.pose.orientation.z, odom_msg->pose.pose.orientation.w);
-    tf::Matrix3x3 m(q);
-    m.getRPY(roll, pitch, yaw);
-    yaw_use = yaw;
+void EkfFusionAlgNode::takeOutput(FilterOutput& output, const char* caller)
+{
+  ///// generate frame -> child transform
+  Eigen::Isometry3d odom2base;
+  this->getOdomToBase(odom2base, caller);
+  output.map2odom = this->fusion_->updateMapToOdom(odom2base);
+  this->fusion_->getStateAndCovariance(output.state, output.covariance);
+  output.version = ++this->filter_version_;
+
+  // cached under alg_, the next odometry step is expressed with it
+  std::lock_guard<std::mutex> lock(this->tf_cache_mutex_);
+  this->tf_cache_.setTransform(this->map2odom_edge_, ros::Time::now().toSec(), output.map2odom);
+}
 
-    //initialization of static variables
-    static double x_prev = odom_msg->pose.pose.position.x;
-    static double y_prev = odom_msg->pose.pose.position.y;
-    static double theta_prev = yaw_use;
+void EkfFusionAlgNode::broadcastMapToOdom(const FilterOutput& output)
+{
+  std::lock_guard<std::mutex> output_lock(this->output_mutex_);
 
-    //for differential problems
-    float diff = yaw_use - theta_prev;
-    if (abs(diff) > PI)
-    {
-      if (yaw_use <= 0.0)
-        yaw_use = yaw_use + 2 * PI;
-      else if (theta_prev <= 0.0)
-        theta_prev = theta_prev + 2 * PI;
-    }
+  // a callback that released alg_ first can get here after a later one
+  if (output.version < this->broadcast_version_)
+    return;
+  this->broadcast_version_ = output.version;
 
-    ///////////////////////////////////////////////////////////
-    ///// TRANSFORM TO TF FARME
-    geometry_msgs::PointStamped point_frame;
-    geometry_msgs::PointStamped point_child;
-    point_child.header.frame_id = this->child_id_;
-    point_child.header.stamp = ros::Time(0); //ros::Time::now();
-    point_child.point.x = odom_msg->pose.pose.position.x;
-    point_child.point.y = odom_msg->pose.pose.position.y;
-    point_child.point.z = 0.0;
-    try
-    {
-      this->listener_.transformPoint(this->frame_id_, point_child, point_frame);
-    }
-    catch (tf::TransformException &ex)
-    {
-      ROS_WARN("[draw_frames] TF exception cb_getRawOdomMsg1:\n%s", ex.what());
-      return;
-    }
-    x_frame = point_frame.point.x;
-    y_frame = point_frame.point.y;
-
-    geometry_msgs::PointStamped point_frame2;
-    geometry_msgs::PointStamped point_child2;
-    point_child2.header.frame_id = this->child_id_;
-    point_child2.header.stamp = ros::Time(0); //ros::Time::now();
-    point_child2.point.x = x_prev;
-    point_child2.point.y = y_prev;
-    point_child2.point.z = 0.0;
-    try
-    {
-      this->listener_.transformPoint(this->frame_id_, point_child2, point_frame2);
+  this->tf_broadcaster_->setMapToOdom(output.map2odom);
 
-    }
-    catch (tf::TransformException &ex)
-    {
-      ROS_WARN("[draw_frames] TF exception cb_getRawOdomMsg2:\n%s", ex.what());
-      return;
-    }
-    x_frame_prev = point_frame2.point.x;
-    y_frame_prev = point_frame2.point.y;
-    ///////////////////////////////////////////////////////////
-
-    ekf::OdomAction act;
-
-    act.delta_x = x_frame - x_frame_prev;
-    act.delta_y = y_frame - y_frame_prev;
-    act.delta_theta = yaw_use - theta_prev;
-    this->ekf_->predict(act);
-
-    //for next step
-    x_prev = odom_msg->pose.pose.position.x;
-    y_prev = odom_msg->pose.pose.position.y;
-    theta_prev = yaw;
-
-    ////////////////////////////////////////////////////////////////////////////////
-    ///// update ros message structure for plot
-    Eigen::Matrix<double, 3, 1> state;
-    Eigen::Matrix<double, 3, 3> covariance;
-    this->ekf_->getStateAndCovariance(state, covariance);
-    this->plot_pose_.header.frame_id = this->frame_id_;
-    tf::Quaternion quaternion = tf::createQuaternionFromRPY(0, 0, state(2));
-    this->plot_pose_.pose.pose.position.x = state(0);
-    this->plot_pose_.pose.pose.position.y = state(1);
-    this->plot_pose_.pose.pose.orientation.x = quaternion[0];
-    this->plot_pose_.pose.pose.orientation.y = quaternion[1];
-    this->plot_pose_.pose.pose.orientation.z = quaternion[2];
-    this->plot_pose_.pose.pose.orientation.w = quaternion[3];
-    this->plot_pose_.pose.covariance[0] = covariance(0, 0);
-    this->plot_pose_.pose.covariance[7] = covariance(1, 1);
-    this->plot_pose_.pose.covariance[14] = 1000000000000.0;
-    this->plot_pose_.pose.covariance[35] = covariance(2, 2);
-    this->flag_plot_pose_ = true;
-    ////////////////////////////////////////////////////////////////////////////////
-
-    ////////////////////////////////////////////////////////////////////////////////
-    ///// generate frame -> child transform
-    tf::StampedTransform tf_odom2base;
-    try
-    {
-      this->listener_.lookupTransform(this->child_id_, "base_link", ros::Time(0), tf_odom2base);
-    }
-    catch (tf::TransformException &ex)
-    {
-      ROS_WARN("[draw_frames] TF exception cb_getRawOdomMsg3:\n%s", ex.what());
-    }
+  if (this->checkpoint_.isOpen())
+    this->checkpoint_.store(output.state, output.covariance, output.map2odom);
+}
 
-    // generate 4x4 transform matrix odom2base
-    Eigen::Affine3d af_odom2base;
-    tf::transformTFToEigen(tf_odom2base, af_odom2base);
-    Eigen::Matrix4d tr_odom2base;
-    tr_odom2base.setIdentity();
-    tr_odom2base.block<3, 3>(0, 0) = af_odom2base.linear();
-    tr_odom2base.block<3, 1>(0, 3) = af_odom2base.translation();
-
-    // generate 4x4 transform matrix map2base
-    Eigen::Matrix4d tr_map2base;
-    tr_map2base.setIdentity();
-    Eigen::Quaterniond rot(quaternion[3], quaternion[0], quaternion[1], quaternion[2]);
-    tr_map2base.block<3, 3>(0, 0) = rot.toRotationMatrix();
-    tr_map2base.block<3, 1>(0, 3) = Eigen::Vector3d(state(0), state(1), 0.0);
-
-    // given: odom2base * map2odom = map2base
-    // thenn: map2odom = map2base * odom2base^(-1)
-    Eigen::Matrix4d tr_map2odom;
-    tr_map2odom = tr_map2base * tr_odom2base.inverse();
-
-    Eigen::Quaterniond quat_final(tr_map2odom.block<3, 3>(0, 0));
-
-    this->odom_to_map_.header.frame_id = this->frame_id_;
-    this->odom_to_map_.child_frame_id = this->child_id_;
-    this->odom_to_map_.header.stamp = ros::Time::now();
-    this->odom_to_map_.transform.translation.x = tr_map2odom(0, 3);
-    this->odom_to_map_.transform.translation.y = tr_map2odom(1, 3);
-    this->odom_to_map_.transform.translation.z = tr_map2odom(2, 3);
-    this->odom_to_map_.transform.rotation.x = quat_final.x();
-    this->odom_to_map_.transform.rotation.y = quat_final.y();
-    this->odom_to_map_.transform.rotation.z = quat_final.z();
-    this->odom_to_map_.transform.rotation.w = quat_final.w();
-
-    this->broadcaster_.sendTransform(this->odom_to_map_);
-    ////////////////////////////////////////////////////////////////////////////////
+/*  [service callbacks] */
+bool EkfFusionAlgNode::get_pose_historyCallback(ekf_fusion::GetPoseHistory::Request &req,
+                                                ekf_fusion::GetPoseHistory::Response &res)
+{
+  std::lock_guard<std::mutex> lock(this->output_mutex_);
 
+  res.frame_id = this->frame_id_;
+  res.poses.resize(req.stamps.size());
+  res.valid.resize(req.stamps.size());
+  for (size_t i = 0; i < req.stamps.size(); i++)
+  {
+    ekf::Pose2D pose;
+    res.valid[i] = this->pose_history_->getPose(req.stamps[i].toSec(), pose);
+    if (res.valid[i])
+    {
+      res.poses[i].x = pose.x;
+      res.poses[i].y = pose.y;
+      res.poses[i].theta = pose.theta;
+    }
   }
 
-  this->alg_.unlock();
+  return true;
 }
 
-/*  [service callbacks] */
-
 /*  [action callbacks] */
 
 /*  [action requests] */
@@ -422,6 +402,30 @@ void EkfFusionAlgNode::node_config_update(Config &config, uint32_t level)
 
 void EkfFusionAlgNode::addNodeDiagnostics(void)
 {
+  this->diagnostic_.add("/odom latency",
+                        boost::bind(&EkfFusionAlgNode::latencyDiagnostics, this, _1, &this->odom_latency_));
+  this->diagnostic_.add("/odometry_gps latency",
+                        boost::bind(&EkfFusionAlgNode::latencyDiagnostics, this, _1, &this->gnss_latency_));
+  this->diagnostic_.add("/initialpose latency",
+                        boost::bind(&EkfFusionAlgNode::latencyDiagnostics, this, _1, &this->init_pose_latency_));
+}
+
+void EkfFusionAlgNode::latencyDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat,
+                                          CLatencyHistogramPtr histogram)
+{
+  ekf::LatencySummary summary;
+  histogram->collect(summary);
+
+  if (summary.p99 > this->latency_warning_)
+    stat.summaryf(diagnostic_msgs::DiagnosticStatus::WARN, "p99 latency %.3f s over %.3f s", summary.p99,
+                  this->latency_warning_);
+  else
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "OK");
+
+  stat.add("count", summary.count);
+  stat.add("p50 [s]", summary.p50);
+  stat.add("p99 [s]", summary.p99);
+  stat.add("max [s]", summary.max);
 }
 
 /* main function */
@@ -0,0 +1,352 @@
+// Microbenchmarks for the ekf_fusion hot path.
+//
+// usage: ekf_fusion_benchmark [samples]
+//
+// Every case is timed in batches of BATCH calls; the per-call latency of each
+// batch is one sample, and p50/p99 are taken over the samples. Heap allocations
+// are counted by interposing malloc/calloc/realloc in this executable (glibc),
+// which also catches operator new and Eigen's aligned allocator.
+//
+// Before timing, CEkfFilterBank is checked against one CEkf per vehicle over a
+// random mix of predictAll, single and batched updates; the exit status is
+// non-zero if any state, covariance or likelihood differs by more than 1e-12.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "ekf_fusion_core.h"
+#include "ekf_filter_bank.h"
+#include "ekf_transform_cache.h"
+#include "particle_filter.h"
+
+static std::atomic<size_t> g_allocations(0);
+
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size)
+{
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+}
+
+namespace
+{
+
+const int BATCH = 32;
+
+struct BenchmarkResult
+{
+  double p50_ns, p99_ns, mean_ns;
+  double allocations_per_call;
+};
+
+volatile double g_sink;
+
+template<class Function>
+  BenchmarkResult run(Function function, int samples)
+  {
+    std::vector<double> ns_per_call(samples);
+
+    // warm up
+    for (int i = 0; i < BATCH * 16; i++)
+      function(i);
+
+    size_t allocations = g_allocations.load(std::memory_order_relaxed);
+    int call = 0;
+    for (int s = 0; s < samples; s++)
+    {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for (int i = 0; i < BATCH; i++)
+        function(call++);
+      std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+      ns_per_call[s] = std::chrono::duration<double, std::nano>(stop - start).count() / BATCH;
+    }
+    allocations = g_allocations.load(std::memory_order_relaxed) - allocations;
+
+    BenchmarkResult result;
+    result.mean_ns = 0.0;
+    for (int s = 0; s < samples; s++)
+      result.mean_ns += ns_per_call[s];
+    result.mean_ns /= samples;
+    std::sort(ns_per_call.begin(), ns_per_call.end());
+    result.p50_ns = ns_per_call[samples / 2];
+    result.p99_ns = ns_per_call[std::min(samples - 1, (samples * 99) / 100)];
+    result.allocations_per_call = static_cast<double>(allocations) / (static_cast<double>(samples) * BATCH);
+    return result;
+  }
+
+void print(const char* name, const BenchmarkResult& result)
+{
+  printf("%-28s %10.1f %10.1f %10.1f %12.3f\n", name, result.p50_ns, result.p99_ns, result.mean_ns,
+         result.allocations_per_call);
+}
+
+ekf::KalmanConfiguration configuration(void)
+{
+  ekf::KalmanConfiguration config;
+  config.x_ini = 1.0;
+  config.y_ini = 1.0;
+  config.theta_ini = 1.0;
+  config.x_model = 0.02;
+  config.y_model = 0.02;
+  config.theta_model = 0.005;
+  config.outlier_mahalanobis_threshold = 5.0;
+  return config;
+}
+
+double randomUniform(double min, double max)
+{
+  return min + (max - min) * (rand() / static_cast<double>(RAND_MAX));
+}
+
+/**
+ * \brief Largest difference between the bank and one CEkf per vehicle fed the same inputs
+ */
+double bankAgreement(void)
+{
+  const size_t N_VEHICLES = 7; // not a multiple of the packet size
+  const int N_STEPS = 2000;
+
+  CEkfFilterBank bank(configuration(), N_VEHICLES);
+  std::vector<CEkfPtr> filters(N_VEHICLES);
+  for (size_t v = 0; v < N_VEHICLES; v++)
+  {
+    filters[v] = new CEkf(configuration());
+    ekf::GnssObservation obs = {randomUniform(-50.0, 50.0), randomUniform(-50.0, 50.0), randomUniform(-3.0, 3.0),
+                                0.04, 0.04, 0.01};
+    bank.update(v, obs);
+    filters[v]->update(obs);
+    bank.setInitialised(v, true);
+    filters[v]->setInitialised(true);
+  }
+
+  double max_difference = 0.0;
+  std::vector<double> delta_x(N_VEHICLES), delta_y(N_VEHICLES), delta_theta(N_VEHICLES);
+  std::vector<size_t> ids;
+  std::vector<ekf::GnssObservation> observations;
+  std::vector<double> likelihoods;
+  for (int step = 0; step < N_STEPS; step++)
+  {
+    for (size_t v = 0; v < N_VEHICLES; v++)
+    {
+      delta_x[v] = randomUniform(-0.1, 0.1);
+      delta_y[v] = randomUniform(-0.1, 0.1);
+      delta_theta[v] = randomUniform(-0.2, 0.2);
+      ekf::OdomAction act = {delta_x[v], delta_y[v], delta_theta[v], 0.0, 0.0, 0.0};
+      filters[v]->predict(act);
+    }
+    bank.predictAll(delta_x.data(), delta_y.data(), delta_theta.data());
+
+    // single updates and batches of 1 to 9 observations, with repeated vehicles; the first batch
+    // has 3, more than the staging lanes padded for the single updates have ids for
+    size_t n = step % 3 == 0 ? 1 : step == 1 ? 3 : 1 + rand() % 9;
+    ids.resize(n);
+    observations.resize(n);
+    likelihoods.resize(n);
+    for (size_t k = 0; k < n; k++)
+    {
+      ids[k] = rand() % N_VEHICLES;
+      Eigen::Matrix<double, 3, 1> state;
+      Eigen::Matrix<double, 3, 3> covariance;
+      filters[ids[k]]->getStateAndCovariance(state, covariance);
+      // one in ten far away, gated out
+      double offset = rand() % 10 == 0 ? 100.0 : 0.3;
+      ekf::GnssObservation obs = {state(0) + randomUniform(-offset, offset), state(1) + randomUniform(-offset, offset),
+                                  state(2) + randomUniform(-0.3, 0.3), 0.04, 0.04, 0.01};
+      if (obs.theta > PI)
+        obs.theta -= 2 * PI;
+      else if (obs.theta < -PI)
+        obs.theta += 2 * PI;
+      observations[k] = obs;
+    }
+    if (step % 3 == 0)
+      likelihoods[0] = bank.update(ids[0], observations[0]);
+    else
+      bank.updateBatch(ids.data(), observations.data(), n, likelihoods.data());
+    for (size_t k = 0; k < n; k++)
+    {
+      double likelihood = filters[ids[k]]->update(observations[k]);
+      max_difference = std::max(max_difference, fabs(likelihood - likelihoods[k]) / std::max(1.0, fabs(likelihood)));
+    }
+
+    for (size_t v = 0; v < N_VEHICLES; v++)
+    {
+      Eigen::Matrix<double, 3, 1> state, bank_state;
+      Eigen::Matrix<double, 3, 3> covariance, bank_covariance;
+      filters[v]->getStateAndCovariance(state, covariance);
+      bank.getStateAndCovariance(v, bank_state, bank_covariance);
+      max_difference = std::max(max_difference, (state - bank_state).cwiseAbs().maxCoeff());
+      max_difference = std::max(max_difference, (covariance - bank_covariance).cwiseAbs().maxCoeff());
+    }
+  }
+
+  for (size_t v = 0; v < N_VEHICLES; v++)
+    delete filters[v];
+  return max_difference;
+}
+
+CEkfPtr initialisedFilter(void)
+{
+  CEkfPtr ekf = new CEkf(configuration());
+  ekf::GnssObservation obs = {1.0, 2.0, 0.3, 0.04, 0.04, 0.01};
+  ekf->update(obs);
+  ekf->flag_ekf_initialised_ = true;
+  return ekf;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+  int samples = argc > 1 ? atoi(argv[1]) : 20000;
+  if (samples < 100)
+    samples = 100;
+
+  // pseudo random inputs, generated before timing
+  const int N_INPUTS = 1024;
+  std::vector<ekf::OdomAction> actions(N_INPUTS);
+  std::vector<double> noise(N_INPUTS * 3);
+  srand(1);
+  for (int i = 0; i < N_INPUTS * 3; i++)
+    noise[i] = (rand() / static_cast<double>(RAND_MAX)) - 0.5;
+  for (int i = 0; i < N_INPUTS; i++)
+  {
+    ekf::OdomAction act = {0.02 * noise[3 * i], 0.02 * noise[3 * i + 1], 0.01 * noise[3 * i + 2], 0.0, 0.0, 0.0};
+    actions[i] = act;
+  }
+
+  const double BANK_TOLERANCE = 1e-12;
+  double bank_difference = bankAgreement();
+  printf("CEkfFilterBank vs CEkf: max difference %.3g%s\n\n", bank_difference,
+         bank_difference > BANK_TOLERANCE ? "  MISMATCH" : "");
+
+  printf("%-28s %10s %10s %10s %12s\n", "case", "p50 [ns]", "p99 [ns]", "mean [ns]", "allocs/call");
+
+  {
+    CEkfPtr ekf = initialisedFilter();
+    print("CEkf::predict", run([&](int i)
+    { ekf->predict(actions[i & (N_INPUTS - 1)]);}, samples));
+    delete ekf;
+  }
+
+  {
+    CEkfPtr ekf = initialisedFilter();
+    Eigen::Matrix<double, 3, 1> state;
+    Eigen::Matrix<double, 3, 3> covariance;
+    print("CEkf::update (accepted)", run([&](int i)
+    {
+      ekf->getStateAndCovariance(state, covariance);
+      int k = i & (N_INPUTS - 1);
+      ekf::GnssObservation obs =
+      { state(0) + 0.1 * noise[3 * k], state(1) + 0.1 * noise[3 * k + 1], state(2) + 0.05 * noise[3 * k + 2],
+        0.04, 0.04, 0.01};
+      g_sink = ekf->update(obs);
+      // keep the covariance from collapsing
+      ekf->setStateAndCovariance(state, covariance);
+    }, samples));
+    delete ekf;
+  }
+
+  {
+    CEkfPtr ekf = initialisedFilter();
+    print("CEkf::update (gated out)", run([&](int i)
+    {
+      int k = i & (N_INPUTS - 1);
+      ekf::GnssObservation obs =
+      { 1000.0 + noise[3 * k], -1000.0 + noise[3 * k + 1], 0.3, 0.04, 0.04, 0.01};
+      g_sink = ekf->update(obs);
+    }, samples));
+    delete ekf;
+  }
+
+  {
+    Eigen::Isometry3d odom2base = ekf::poseToIsometry(12.0, -3.0, 0.7);
+    Eigen::Matrix<double, 3, 1> state(100.0, 50.0, 0.2);
+    print("map->odom composition", run([&](int i)
+    {
+      state(2) = noise[i & (N_INPUTS - 1)];
+      Eigen::Isometry3d map2odom = ekf::composeMapToOdom(state, odom2base);
+      Eigen::Quaterniond quat_final(map2odom.linear());
+      g_sink = map2odom.translation()(0) + quat_final.w();
+    }, samples));
+  }
+
+  {
+    CTransformCache cache;
+    size_t map2odom_edge = cache.addEdge("map", "odom");
+    size_t odom2base_edge = cache.addEdge("odom", "base_link");
+    cache.setTransform(map2odom_edge, 1.0, ekf::poseToIsometry(5.0, 3.0, 0.4));
+    cache.setTransform(odom2base_edge, 1.0, ekf::poseToIsometry(12.0, -3.0, 0.7));
+    ekf::OdomPose prev = {0.0, 12.0, -3.0, 0.7};
+    print("odom action (cached tf)", run([&](int i)
+    {
+      int k = i & (N_INPUTS - 1);
+      ekf::OdomPose curr = {0.01, prev.x + 0.02 * noise[3 * k], prev.y + 0.02 * noise[3 * k + 1],
+                            prev.theta + 0.01 * noise[3 * k + 2]};
+      Eigen::Isometry3d map2odom;
+      cache.getTransform(map2odom_edge, map2odom);
+      ekf::OdomAction act = ekf::makeOdomAction(prev, curr, map2odom);
+      g_sink = act.delta_x + act.delta_theta;
+    }, samples));
+  }
+
+  {
+    // particle filter backend, 10000 particles on the calling thread
+    ekf::ParticleFilterConfiguration particle_config;
+    particle_config.n_particles = 10000;
+    particle_config.n_threads = 1;
+    particle_config.resampling_threshold = 0.5;
+    particle_config.reverse_heading_weight = 0.1;
+    CParticleFilter filter(configuration(), particle_config);
+    ekf::GnssObservation init = {1.0, 2.0, 0.3, 0.04, 0.04, 0.01};
+    filter.update(init);
+    filter.setInitialised(true);
+    int particle_samples = std::max(100, samples / 100);
+
+    print("CParticleFilter::predict", run([&](int i)
+    { filter.predict(actions[i & (N_INPUTS - 1)]);}, particle_samples));
+
+    Eigen::Matrix<double, 3, 1> state;
+    Eigen::Matrix<double, 3, 3> covariance;
+    print("CParticleFilter::update", run([&](int i)
+    {
+      filter.getStateAndCovariance(state, covariance);
+      int k = i & (N_INPUTS - 1);
+      ekf::GnssObservation obs =
+      { state(0) + 0.1 * noise[3 * k], state(1) + 0.1 * noise[3 * k + 1], state(2) + 0.05 * noise[3 * k + 2],
+        0.04, 0.04, 0.01};
+      g_sink = filter.update(obs);
+      filter.predict(actions[k]);
+    }, particle_samples));
+
+    print("CParticleFilter summary", run([&](int i)
+    {
+      filter.setInitialised(true);
+      filter.predict(actions[i & (N_INPUTS - 1)]);
+      filter.getStateAndCovariance(state, covariance);
+      g_sink = state(0);
+    }, particle_samples));
+  }
+
+  return bank_difference > BANK_TOLERANCE ? 2 : 0;
+}
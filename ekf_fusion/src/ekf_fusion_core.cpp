@@ -0,0 +1,379 @@
+#include "ekf_fusion_core.h"
+
+ekf::GnssObservation ekf::makeGnssObservation(const ekf::GnssFix& fix, const Eigen::Matrix<double, 3, 1>& state)
+{
+  ekf::GnssObservation obs;
+
+  obs.x = fix.x;
+  obs.y = fix.y;
+  obs.theta = fix.theta;
+  obs.sigma_x = fix.sigma_x;
+  obs.sigma_y = fix.sigma_y;
+  obs.sigma_theta = fix.sigma_theta;
+
+  // rear direction protection
+  double diff = state(2) - obs.theta;
+  if (fabs(diff) > PI)
+  {
+    if (state(2) <= 0.0)
+      diff = (state(2) + 2 * PI) - obs.theta;
+    else if (obs.theta <= 0.0)
+      diff = state(2) - (obs.theta + 2 * PI);
+  }
+  if (fabs(diff) > PI / 2)
+  {
+    obs.theta = state(2);
+  }
+
+  return obs;
+}
+
+ekf::GnssObservation ekf::makeGnssObservation(const ekf::GnssFix& fix)
+{
+  ekf::GnssObservation obs;
+
+  obs.x = fix.x;
+  obs.y = fix.y;
+  obs.theta = fix.theta;
+  obs.sigma_x = fix.sigma_x;
+  obs.sigma_y = fix.sigma_y;
+  obs.sigma_theta = fix.sigma_theta;
+
+  return obs;
+}
+
+ekf::OdomAction ekf::makeOdomAction(const ekf::OdomPose& prev, const ekf::OdomPose& curr,
+                                    const Eigen::Isometry3d& map2odom)
+{
+  ekf::OdomAction act;
+
+  double yaw_use = curr.theta;
+  double theta_prev = prev.theta;
+
+  //for differential problems
+  double diff = yaw_use - theta_prev;
+  if (fabs(diff) > PI)
+  {
+    if (yaw_use <= 0.0)
+      yaw_use = yaw_use + 2 * PI;
+    else if (theta_prev <= 0.0)
+      theta_prev = theta_prev + 2 * PI;
+  }
+
+  // displacement in the map frame (the translation of map2odom cancels out)
+  Eigen::Vector3d delta = map2odom.linear() * Eigen::Vector3d(curr.x - prev.x, curr.y - prev.y, 0.0);
+
+  act.delta_x = delta(0);
+  act.delta_y = delta(1);
+  act.delta_theta = yaw_use - theta_prev;
+  act.sigma_x = 0.0;
+  act.sigma_y = 0.0;
+  act.sigma_theta = 0.0;
+
+  return act;
+}
+
+Eigen::Isometry3d ekf::composeMapToOdom(const Eigen::Matrix<double, 3, 1>& state, const Eigen::Isometry3d& odom2base)
+{
+  return ekf::poseToIsometry(state(0), state(1), state(2)) * odom2base.inverse();
+}
+
+Eigen::Isometry3d ekf::poseToIsometry(double x, double y, double theta)
+{
+  Eigen::Isometry3d tr = Eigen::Isometry3d::Identity();
+  tr.linear() = Eigen::AngleAxisd(theta, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+  tr.translation() = Eigen::Vector3d(x, y, 0.0);
+  return tr;
+}
+
+CEkfFusion::CEkfFusion(ekf::KalmanConfiguration kalman_configuration, ekf::FusionConfiguration fusion_configuration)
+{
+  config_ = fusion_configuration;
+  if (config_.filter_type == ekf::PARTICLE_FILTER)
+  {
+    filter_ = new CParticleFilter(kalman_configuration, config_.particle_config);
+    // a particle set can not be restored from the stored Gaussian summaries
+    config_.rewind_buffer_size = 0;
+  }
+  else
+  {
+    filter_ = new CEkf(kalman_configuration);
+  }
+
+  first_gnss_ = true;
+  has_prev_odom_ = false;
+  map2odom_.setIdentity();
+
+  clearPendingOdometry();
+  pending_stamp_ = 0.0;
+  last_step_stamp_ = 0.0;
+
+  history_.resize(config_.rewind_buffer_size);
+  late_gnss_count_ = 0;
+  clearHistory();
+}
+
+CEkfFusion::~CEkfFusion(void)
+{
+  delete filter_;
+}
+
+void CEkfFusion::setInitialPose(double x, double y, double theta)
+{
+  Eigen::Matrix<double, 3, 1> state;
+  Eigen::Matrix<double, 3, 3> covariance;
+  filter_->getStateAndCovariance(state, covariance);
+  state(0) = x;
+  state(1) = y;
+  state(2) = theta;
+  filter_->setStateAndCovariance(state, covariance);
+
+  // a manual relocation can not be replayed, and overrides the odometry not applied yet
+  clearHistory();
+  clearPendingOdometry();
+}
+
+void CEkfFusion::restore(const Eigen::Matrix<double, 3, 1>& state, const Eigen::Matrix<double, 3, 3>& covariance,
+                         const Eigen::Isometry3d& map2odom)
+{
+  filter_->setStateAndCovariance(state, covariance);
+  filter_->setInitialised(true);
+  first_gnss_ = false;
+  map2odom_ = map2odom;
+
+  clearHistory();
+  clearPendingOdometry();
+}
+
+bool CEkfFusion::processGnss(const ekf::GnssFix& fix)
+{
+  double speed = sqrt(fix.vx * fix.vx + fix.vy * fix.vy);
+
+  if (!(speed > config_.min_speed || (config_.is_simulation && first_gnss_)))
+    return false;
+
+  if (!filter_->isInitialised())
+  {
+    filter_->update(makeObservation(fix));
+    clearHistory();
+  }
+  else if (history_.empty())
+  {
+    flushOdometry();
+
+    HistoryEntry entry;
+    entry.is_gnss = true;
+    entry.fix = fix;
+    applyEntry(entry);
+  }
+  else
+  {
+    flushOdometry();
+    rewindGnss(fix);
+  }
+
+  filter_->setInitialised(true);
+  first_gnss_ = false;
+
+  return true;
+}
+
+bool CEkfFusion::processOdometry(const ekf::OdomPose& odom, const Eigen::Isometry3d& map2odom)
+{
+  if (!filter_->isInitialised())
+    return false;
+
+  if (!has_prev_odom_)
+  {
+    prev_odom_ = odom;
+    last_step_stamp_ = odom.stamp;
+    has_prev_odom_ = true;
+  }
+
+  ekf::OdomAction act = ekf::makeOdomAction(prev_odom_, odom, map2odom);
+
+  //for next step
+  prev_odom_ = odom;
+
+  pending_act_.delta_x += act.delta_x;
+  pending_act_.delta_y += act.delta_y;
+  pending_act_.delta_theta += act.delta_theta;
+  pending_steps_++;
+  pending_stamp_ = odom.stamp;
+
+  // a stamp going back (restarted clock) also closes the step
+  double elapsed = odom.stamp - last_step_stamp_;
+  if (config_.preintegration_rate > 0.0 && elapsed >= 0.0 && elapsed < 1.0 / config_.preintegration_rate)
+    return false;
+
+  flushOdometry();
+  return true;
+}
+
+void CEkfFusion::flushOdometry(void)
+{
+  if (pending_steps_ == 0)
+    return;
+
+  HistoryEntry entry;
+  entry.is_gnss = false;
+  entry.stamp = pending_stamp_;
+  entry.act = pending_act_;
+  entry.steps = pending_steps_;
+
+  if (history_.empty())
+    applyEntry(entry);
+  else
+    applyEntry(historyAt(insertHistory(history_count_, entry)));
+
+  last_step_stamp_ = pending_stamp_;
+  clearPendingOdometry();
+}
+
+ekf::GnssObservation CEkfFusion::makeObservation(const ekf::GnssFix& fix)
+{
+  if (!filter_->needsHeadingProtection())
+    return ekf::makeGnssObservation(fix);
+
+  Eigen::Matrix<double, 3, 1> state;
+  Eigen::Matrix<double, 3, 3> covariance;
+  filter_->getStateAndCovariance(state, covariance);
+  return ekf::makeGnssObservation(fix, state);
+}
+
+void CEkfFusion::applyEntry(HistoryEntry& entry)
+{
+  if (!history_.empty())
+    filter_->getStateAndCovariance(entry.state, entry.covariance);
+
+  if (entry.is_gnss)
+    filter_->update(makeObservation(entry.fix));
+  else
+    filter_->predict(entry.act, entry.steps);
+}
+
+size_t CEkfFusion::insertHistory(size_t index, const HistoryEntry& entry)
+{
+  if (history_count_ == history_.size())
+  {
+    // drop the oldest step
+    history_head_ = (history_head_ + 1) % history_.size();
+    history_count_--;
+    if (index > 0)
+      index--;
+  }
+
+  history_count_++;
+  for (size_t i = history_count_ - 1; i > index; i--)
+    historyAt(i) = historyAt(i - 1);
+  historyAt(index) = entry;
+
+  return index;
+}
+
+void CEkfFusion::rewindGnss(const ekf::GnssFix& fix)
+{
+  HistoryEntry entry;
+  entry.is_gnss = true;
+  entry.stamp = fix.stamp;
+  entry.fix = fix;
+
+  // first step after the fix (binary search, the buffer is sorted by stamp)
+  size_t first = 0;
+  size_t last = history_count_;
+  while (first < last)
+  {
+    size_t middle = (first + last) / 2;
+    if (historyAt(middle).stamp <= fix.stamp)
+      first = middle + 1;
+    else
+      last = middle;
+  }
+
+  if (first == history_count_ || (first == 0 && history_count_ == history_.size()))
+  {
+    // in sequence, or older than the buffer: applied to the current state
+    if (first != history_count_)
+    {
+      entry.stamp = historyAt(history_count_ - 1).stamp;
+      late_gnss_count_++;
+    }
+    applyEntry(historyAt(insertHistory(history_count_, entry)));
+    return;
+  }
+
+  // rewind to the state before the first later step, update there and replay
+  filter_->setStateAndCovariance(historyAt(first).state, historyAt(first).covariance);
+  size_t index = insertHistory(first, entry);
+  for (size_t i = index; i < history_count_; i++)
+    applyEntry(historyAt(i));
+}
+
+const Eigen::Isometry3d& CEkfFusion::updateMapToOdom(const Eigen::Isometry3d& odom2base)
+{
+  Eigen::Matrix<double, 3, 1> state;
+  Eigen::Matrix<double, 3, 3> covariance;
+  filter_->getStateAndCovariance(state, covariance);
+
+  map2odom_ = ekf::composeMapToOdom(state, odom2base);
+
+  return map2odom_;
+}
+
+CReplayDriver::CReplayDriver(CEkfFusion& fusion, CReplayHook& hook) :
+    fusion_(fusion), hook_(hook)
+{
+  odom2base_.setIdentity();
+}
+
+CReplayDriver::~CReplayDriver(void)
+{
+}
+
+void CReplayDriver::apply(const ekf::ReplayEvent& event)
+{
+  switch (event.type)
+  {
+    case ekf::ReplayEvent::ODOM:
+    {
+      odom2base_ = ekf::poseToIsometry(event.x, event.y, event.theta);
+      if (!fusion_.isInitialised())
+        return;
+
+      ekf::OdomPose odom;
+      odom.stamp = event.stamp;
+      odom.x = event.x;
+      odom.y = event.y;
+      odom.theta = event.theta;
+      if (!fusion_.processOdometry(odom, fusion_.getMapToOdom()))
+        return;
+      break;
+    }
+    case ekf::ReplayEvent::GNSS:
+    {
+      ekf::GnssFix fix;
+      fix.stamp = event.stamp;
+      fix.x = event.x;
+      fix.y = event.y;
+      fix.theta = event.theta;
+      fix.vx = event.vx;
+      fix.vy = event.vy;
+      fix.sigma_x = event.var_x;
+      fix.sigma_y = event.var_y;
+      fix.sigma_theta = event.var_theta;
+      if (!fusion_.processGnss(fix))
+        return;
+      break;
+    }
+    case ekf::ReplayEvent::INIT:
+    {
+      if (!fusion_.isInitialised())
+        return;
+      fusion_.setInitialPose(event.x, event.y, event.theta);
+      break;
+    }
+  }
+
+  fusion_.updateMapToOdom(odom2base_);
+  hook_.step(event, fusion_);
+}
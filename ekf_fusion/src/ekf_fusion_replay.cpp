@@ -0,0 +1,115 @@
+// Offline replay of a recorded drive through the ekf_fusion core.
+//
+// usage: ekf_fusion_replay <input.csv> <output.csv> <x_model> <y_model> <theta_model>
+//                          <outlier_mahalanobis> <min_speed> [is_simulation] [rewind_buffer_size]
+//                          [preintegration_rate] [filter]
+//
+// filter is "ekf" (default) or "particle" (10000 particles, one thread).
+//
+// The input layout is described in ekf_replay_log.h. One output row is written
+// per odometry filter step, i.e. per odometry event unless the odometry is
+// pre-integrated (the /pose_plot equivalent):
+//   stamp,x,y,yaw,var_x,var_y,var_yaw
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include "ekf_fusion_core.h"
+#include "ekf_replay_log.h"
+
+/**
+ * \brief Writes the filter output of every odometry step
+ */
+class CReplayOutput : public CReplayHook
+{
+private:
+  FILE* output_;
+  Eigen::Matrix<double, 3, 1> state_;
+  Eigen::Matrix<double, 3, 3> covariance_;
+
+public:
+  CReplayOutput(FILE* output) :
+      output_(output)
+  {
+  }
+
+  void step(const ekf::ReplayEvent& event, CEkfFusion& fusion)
+  {
+    if (event.type != ekf::ReplayEvent::ODOM)
+      return;
+
+    fusion.getStateAndCovariance(state_, covariance_);
+    fprintf(output_, "%.9f,%.6f,%.6f,%.6f,%.9g,%.9g,%.9g\n", event.stamp, state_(0), state_(1), state_(2),
+            covariance_(0, 0), covariance_(1, 1), covariance_(2, 2));
+  }
+};
+
+int main(int argc, char *argv[])
+{
+  if (argc < 8)
+  {
+    fprintf(stderr, "usage: %s <input.csv> <output.csv> <x_model> <y_model> <theta_model> "
+            "<outlier_mahalanobis> <min_speed> [is_simulation] [rewind_buffer_size] [preintegration_rate] [filter]\n",
+            argv[0]);
+    return 1;
+  }
+
+  ekf::KalmanConfiguration kalman_config;
+  kalman_config.x_ini = 1.0;
+  kalman_config.y_ini = 1.0;
+  kalman_config.theta_ini = 1.0;
+  kalman_config.x_model = atof(argv[3]);
+  kalman_config.y_model = atof(argv[4]);
+  kalman_config.theta_model = atof(argv[5]);
+  kalman_config.outlier_mahalanobis_threshold = atof(argv[6]);
+
+  ekf::FusionConfiguration fusion_config;
+  fusion_config.min_speed = atof(argv[7]);
+  fusion_config.is_simulation = argc > 8 && atoi(argv[8]) != 0;
+  fusion_config.rewind_buffer_size = argc > 9 ? atoi(argv[9]) : 0;
+  fusion_config.preintegration_rate = argc > 10 ? atof(argv[10]) : 0.0;
+  fusion_config.filter_type =
+      argc > 11 && std::string(argv[11]) == "particle" ? ekf::PARTICLE_FILTER : ekf::EKF_FILTER;
+  fusion_config.particle_config.n_particles = 10000;
+  fusion_config.particle_config.n_threads = 1;
+  fusion_config.particle_config.resampling_threshold = 0.5;
+  fusion_config.particle_config.reverse_heading_weight = 0.1;
+
+  CReplayLogReader reader;
+  if (!reader.open(argv[1]))
+  {
+    fprintf(stderr, "ekf_fusion_replay: cannot open %s\n", argv[1]);
+    return 1;
+  }
+
+  FILE* output = fopen(argv[2], "w");
+  if (output == NULL)
+  {
+    fprintf(stderr, "ekf_fusion_replay: cannot open %s\n", argv[2]);
+    return 1;
+  }
+  fprintf(output, "stamp,x,y,yaw,var_x,var_y,var_yaw\n");
+
+  CEkfFusion fusion(kalman_config, fusion_config);
+  CReplayOutput hook(output);
+  CReplayDriver driver(fusion, hook);
+
+  size_t n_events = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  ekf::ReplayEvent event;
+  while (reader.next(event))
+  {
+    n_events++;
+    driver.apply(event);
+  }
+
+  fclose(output);
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  fprintf(stderr, "ekf_fusion_replay: %zu events in %.3f s (%.0f events/s), %zu lines skipped\n", n_events, elapsed,
+          elapsed > 0.0 ? n_events / elapsed : 0.0, reader.getSkippedLines());
+
+  return 0;
+}
@@ -0,0 +1,138 @@
+// Offline Rauch-Tung-Striebel smoothing of a recorded drive.
+//
+// usage: ekf_fusion_smoother <input.csv> <output.csv> <x_model> <y_model> <theta_model>
+//                            <outlier_mahalanobis> <min_speed> [is_simulation] [chunk_size] [lookahead]
+//
+// The forward pass is the one of ekf_fusion_replay with the EKF, a prediction
+// per odometry event and the fixes applied in log order. chunk_size (default
+// 100000) and lookahead (default 2000) are in odometry steps and bound the
+// memory of the backward pass (see ekf_smoother.h). The input layout is
+// described in ekf_replay_log.h. One output row is written per odometry step,
+// as ekf_fusion_replay does, with the smoothed estimate:
+//   stamp,x,y,yaw,var_x,var_y,var_yaw
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include "ekf_fusion_core.h"
+#include "ekf_replay_log.h"
+#include "ekf_smoother.h"
+
+void writeOutput(FILE* output, CEkfSmoother& smoother)
+{
+  const std::vector<ekf::SmoothedStep>& steps = smoother.getOutput();
+  for (size_t i = 0; i < steps.size(); i++)
+    fprintf(output, "%.9f,%.6f,%.6f,%.6f,%.9g,%.9g,%.9g\n", steps[i].stamp, steps[i].state(0), steps[i].state(1),
+            steps[i].state(2), steps[i].covariance(0, 0), steps[i].covariance(1, 1), steps[i].covariance(2, 2));
+  smoother.clearOutput();
+}
+
+/**
+ * \brief Hands the forward pass to the smoother
+ */
+class CSmootherInput : public CReplayHook
+{
+private:
+  CEkfSmoother& smoother_;
+  Eigen::Matrix<double, 3, 1> state_;
+  Eigen::Matrix<double, 3, 3> covariance_;
+
+public:
+  CSmootherInput(CEkfSmoother& smoother) :
+      smoother_(smoother)
+  {
+  }
+
+  void step(const ekf::ReplayEvent& event, CEkfFusion& fusion)
+  {
+    switch (event.type)
+    {
+      case ekf::ReplayEvent::ODOM:
+        fusion.getStateAndCovariance(state_, covariance_);
+        smoother_.addStep(event.stamp, state_, covariance_);
+        break;
+      case ekf::ReplayEvent::GNSS:
+        fusion.getStateAndCovariance(state_, covariance_);
+        smoother_.updateStep(state_, covariance_);
+        break;
+      case ekf::ReplayEvent::INIT:
+        // a relocation is not a filter step, the smoothing does not go across it
+        smoother_.endSegment();
+        break;
+    }
+  }
+};
+
+int main(int argc, char *argv[])
+{
+  if (argc < 8)
+  {
+    fprintf(stderr, "usage: %s <input.csv> <output.csv> <x_model> <y_model> <theta_model> "
+            "<outlier_mahalanobis> <min_speed> [is_simulation] [chunk_size] [lookahead]\n",
+            argv[0]);
+    return 1;
+  }
+
+  ekf::KalmanConfiguration kalman_config;
+  kalman_config.x_ini = 1.0;
+  kalman_config.y_ini = 1.0;
+  kalman_config.theta_ini = 1.0;
+  kalman_config.x_model = atof(argv[3]);
+  kalman_config.y_model = atof(argv[4]);
+  kalman_config.theta_model = atof(argv[5]);
+  kalman_config.outlier_mahalanobis_threshold = atof(argv[6]);
+
+  ekf::FusionConfiguration fusion_config;
+  fusion_config.min_speed = atof(argv[7]);
+  fusion_config.is_simulation = argc > 8 && atoi(argv[8]) != 0;
+  fusion_config.rewind_buffer_size = 0;
+  fusion_config.preintegration_rate = 0.0;
+  fusion_config.filter_type = ekf::EKF_FILTER;
+
+  int chunk_size = argc > 9 ? atoi(argv[9]) : 100000;
+  int lookahead = argc > 10 ? atoi(argv[10]) : 2000;
+
+  CReplayLogReader reader;
+  if (!reader.open(argv[1]))
+  {
+    fprintf(stderr, "ekf_fusion_smoother: cannot open %s\n", argv[1]);
+    return 1;
+  }
+
+  FILE* output = fopen(argv[2], "w");
+  if (output == NULL)
+  {
+    fprintf(stderr, "ekf_fusion_smoother: cannot open %s\n", argv[2]);
+    return 1;
+  }
+  fprintf(output, "stamp,x,y,yaw,var_x,var_y,var_yaw\n");
+
+  CEkfFusion fusion(kalman_config, fusion_config);
+  CEkfSmoother smoother(chunk_size > 0 ? chunk_size : 1, lookahead > 0 ? lookahead : 0);
+
+  CSmootherInput hook(smoother);
+  CReplayDriver driver(fusion, hook);
+
+  size_t n_events = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  ekf::ReplayEvent event;
+  while (reader.next(event))
+  {
+    n_events++;
+    driver.apply(event);
+
+    if (!smoother.getOutput().empty())
+      writeOutput(output, smoother);
+  }
+
+  smoother.endSegment();
+  writeOutput(output, smoother);
+  fclose(output);
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  fprintf(stderr, "ekf_fusion_smoother: %zu events in %.3f s (%.0f events/s), %zu lines skipped\n", n_events,
+          elapsed, elapsed > 0.0 ? n_events / elapsed : 0.0, reader.getSkippedLines());
+
+  return 0;
+}
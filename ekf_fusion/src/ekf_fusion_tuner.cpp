@@ -0,0 +1,290 @@
+// Offline tuning of the ekf_fusion noise parameters against a reference trajectory.
+//
+// usage: ekf_fusion_tuner <input.csv> <reference.csv> <x_model> <y_model> <theta_model>
+//                         <outlier_mahalanobis> <min_speed> [is_simulation] [threads] [max_evaluations]
+//
+// The recorded drive (layout in ekf_replay_log.h) is loaded once and replayed
+// through the ekf_fusion core, as ekf_fusion_replay does (EKF, rewind buffer of
+// 100 steps), for every candidate parameter set. A candidate is scored by the
+// position RMSE of its odometry steps against the reference trajectory
+// (stamp,x,y,yaw[,...] rows, e.g. RTK ground truth or the ekf_fusion_smoother
+// output), interpolated at the step stamps; steps outside it are not scored.
+//
+// x_model, y_model, theta_model and outlier_mahalanobis are the starting point
+// of a pattern search in log space: every iteration scores each parameter
+// scaled by step^-2, step^-1, step and step^2 (16 candidates, run in parallel
+// on `threads` threads, all cores by default), moves to the best one and
+// halves the log step when none improves, until the step is under 1 % or
+// max_evaluations (default 2000) candidates are scored.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <limits>
+#include <thread>
+#include <vector>
+#include "ekf_fusion_core.h"
+#include "ekf_replay_log.h"
+#include "pose_history.h"
+#include "thread_pool.h"
+
+static const int N_PARAMETERS = 4;
+static const char* PARAMETER_NAMES[N_PARAMETERS] = {"x_model", "y_model", "theta_model", "outlier_mahalanobis"};
+
+struct Score
+{
+  double position_rmse;
+  double yaw_rmse;
+  size_t n_steps;
+};
+
+bool loadReference(const char* path, std::vector<double>& stamps, std::vector<ekf::Pose2D>& poses)
+{
+  FILE* file = fopen(path, "r");
+  if (file == NULL)
+    return false;
+
+  char line[512];
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    double values[4];
+    char* cursor = line;
+    char* end;
+    int i;
+    for (i = 0; i < 4; i++)
+    {
+      values[i] = strtod(cursor, &end);
+      if (end == cursor || (*end != ',' && i < 3))
+        break;
+      cursor = end + 1;
+    }
+    // header, comments and malformed rows
+    if (i < 4)
+      continue;
+
+    ekf::Pose2D pose;
+    pose.x = values[1];
+    pose.y = values[2];
+    pose.theta = values[3];
+    stamps.push_back(values[0]);
+    poses.push_back(pose);
+  }
+  fclose(file);
+  return !stamps.empty();
+}
+
+/**
+ * \brief Accumulates the squared errors of the odometry steps against the reference
+ */
+class CReferenceError : public CReplayHook
+{
+private:
+  const CPoseHistory& reference_;
+  Eigen::Matrix<double, 3, 1> state_;
+  Eigen::Matrix<double, 3, 3> covariance_;
+
+public:
+  double position_error;
+  double yaw_error;
+  size_t n_steps;
+
+  CReferenceError(const CPoseHistory& reference) :
+      reference_(reference), position_error(0.0), yaw_error(0.0), n_steps(0)
+  {
+  }
+
+  void step(const ekf::ReplayEvent& event, CEkfFusion& fusion)
+  {
+    ekf::Pose2D truth;
+    if (event.type != ekf::ReplayEvent::ODOM || !reference_.getPose(event.stamp, truth))
+      return;
+
+    fusion.getStateAndCovariance(state_, covariance_);
+    double dyaw = state_(2) - truth.theta;
+    position_error += pow(state_(0) - truth.x, 2) + pow(state_(1) - truth.y, 2);
+    yaw_error += pow(atan2(sin(dyaw), cos(dyaw)), 2);
+    n_steps++;
+  }
+};
+
+Score evaluate(const std::vector<ekf::ReplayEvent>& events, const CPoseHistory& reference,
+               ekf::KalmanConfiguration kalman_config, ekf::FusionConfiguration fusion_config)
+{
+  CEkfFusion fusion(kalman_config, fusion_config);
+  CReferenceError error(reference);
+  CReplayDriver driver(fusion, error);
+
+  for (size_t i = 0; i < events.size(); i++)
+    driver.apply(events[i]);
+
+  Score score;
+  score.n_steps = error.n_steps;
+  if (score.n_steps == 0)
+  {
+    score.position_rmse = std::numeric_limits<double>::infinity();
+    score.yaw_rmse = std::numeric_limits<double>::infinity();
+    return score;
+  }
+  score.position_rmse = sqrt(error.position_error / score.n_steps);
+  score.yaw_rmse = sqrt(error.yaw_error / score.n_steps);
+  return score;
+}
+
+/**
+ * \brief Scores a batch of candidates (log parameters) in parallel, one task per candidate
+ */
+struct BatchEvaluation
+{
+  const std::vector<ekf::ReplayEvent>* events;
+  const CPoseHistory* reference;
+  ekf::KalmanConfiguration kalman_config;
+  ekf::FusionConfiguration fusion_config;
+  std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > candidates;
+  std::vector<Score> scores;
+
+  void operator()(size_t index)
+  {
+    ekf::KalmanConfiguration config = kalman_config;
+    config.x_model = exp(candidates[index](0));
+    config.y_model = exp(candidates[index](1));
+    config.theta_model = exp(candidates[index](2));
+    config.outlier_mahalanobis_threshold = exp(candidates[index](3));
+    scores[index] = evaluate(*events, *reference, config, fusion_config);
+  }
+};
+
+void printParameters(const char* label, const Eigen::Vector4d& log_parameters, const Score& score)
+{
+  fprintf(stderr, "%s", label);
+  for (int i = 0; i < N_PARAMETERS; i++)
+    fprintf(stderr, " %s=%.6g", PARAMETER_NAMES[i], exp(log_parameters(i)));
+  fprintf(stderr, " -> position rmse %.4f m, yaw rmse %.4f rad (%zu steps)\n", score.position_rmse, score.yaw_rmse,
+          score.n_steps);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 8)
+  {
+    fprintf(stderr, "usage: %s <input.csv> <reference.csv> <x_model> <y_model> <theta_model> "
+            "<outlier_mahalanobis> <min_speed> [is_simulation] [threads] [max_evaluations]\n",
+            argv[0]);
+    return 1;
+  }
+
+  BatchEvaluation batch;
+  batch.kalman_config.x_ini = 1.0;
+  batch.kalman_config.y_ini = 1.0;
+  batch.kalman_config.theta_ini = 1.0;
+  batch.fusion_config.min_speed = atof(argv[7]);
+  batch.fusion_config.is_simulation = argc > 8 && atoi(argv[8]) != 0;
+  batch.fusion_config.rewind_buffer_size = 100;
+  batch.fusion_config.preintegration_rate = 0.0;
+  batch.fusion_config.filter_type = ekf::EKF_FILTER;
+
+  Eigen::Vector4d parameters;
+  for (int i = 0; i < N_PARAMETERS; i++)
+  {
+    parameters(i) = atof(argv[3 + i]);
+    if (!(parameters(i) > 0.0))
+    {
+      fprintf(stderr, "ekf_fusion_tuner: %s must be positive\n", PARAMETER_NAMES[i]);
+      return 1;
+    }
+  }
+  Eigen::Vector4d log_parameters = parameters.array().log();
+
+  int threads = argc > 9 ? atoi(argv[9]) : 0;
+  if (threads <= 0)
+    threads = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+  int max_evaluations = argc > 10 ? atoi(argv[10]) : 2000;
+
+  // the log is replayed from memory by every candidate
+  std::vector<ekf::ReplayEvent> events;
+  CReplayLogReader reader;
+  if (!reader.open(argv[1]))
+  {
+    fprintf(stderr, "ekf_fusion_tuner: cannot open %s\n", argv[1]);
+    return 1;
+  }
+  ekf::ReplayEvent event;
+  while (reader.next(event))
+    events.push_back(event);
+  reader.close();
+
+  std::vector<double> reference_stamps;
+  std::vector<ekf::Pose2D> reference_poses;
+  if (!loadReference(argv[2], reference_stamps, reference_poses))
+  {
+    fprintf(stderr, "ekf_fusion_tuner: cannot read the reference trajectory %s\n", argv[2]);
+    return 1;
+  }
+  CPoseHistory reference(reference_stamps.size());
+  for (size_t i = 0; i < reference_stamps.size(); i++)
+    reference.add(reference_stamps[i], reference_poses[i]);
+
+  batch.events = &events;
+  batch.reference = &reference;
+
+  CThreadPool pool(threads);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  batch.candidates.assign(1, log_parameters);
+  batch.scores.resize(1);
+  pool.run(1, batch);
+  Score best = batch.scores[0];
+  int n_evaluations = 1;
+  printParameters("initial:", log_parameters, best);
+
+  const double MULTIPLIERS[4] = {-2.0, -1.0, 1.0, 2.0};
+  double step = log(2.0);
+  int iteration = 0;
+  while (step > log(1.01) && n_evaluations < max_evaluations)
+  {
+    batch.candidates.clear();
+    for (int i = 0; i < N_PARAMETERS; i++)
+    {
+      for (int j = 0; j < 4; j++)
+      {
+        Eigen::Vector4d candidate = log_parameters;
+        candidate(i) += MULTIPLIERS[j] * step;
+        batch.candidates.push_back(candidate);
+      }
+    }
+    batch.scores.resize(batch.candidates.size());
+    pool.run(batch.candidates.size(), batch);
+    n_evaluations += batch.candidates.size();
+
+    size_t best_candidate = batch.candidates.size();
+    for (size_t i = 0; i < batch.candidates.size(); i++)
+    {
+      if (batch.scores[i].position_rmse < best.position_rmse)
+      {
+        best = batch.scores[i];
+        best_candidate = i;
+      }
+    }
+
+    iteration++;
+    if (best_candidate < batch.candidates.size())
+    {
+      log_parameters = batch.candidates[best_candidate];
+      char label[64];
+      snprintf(label, sizeof(label), "iteration %d:", iteration);
+      printParameters(label, log_parameters, best);
+    }
+    else
+      step *= 0.5;
+  }
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  fprintf(stderr, "ekf_fusion_tuner: %d evaluations of %zu events in %.3f s on %d threads\n", n_evaluations,
+          events.size(), elapsed, threads);
+
+  // parameter file lines (/ekf_fusion namespace)
+  for (int i = 0; i < N_PARAMETERS; i++)
+    printf("%s: %.6g\n", PARAMETER_NAMES[i], exp(log_parameters(i)));
+
+  return 0;
+}
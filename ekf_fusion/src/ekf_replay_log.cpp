@@ -0,0 +1,94 @@
+#include "ekf_replay_log.h"
+
+#include <cstdlib>
+#include <cstring>
+
+CReplayLogReader::CReplayLogReader(void)
+{
+  file_ = NULL;
+  line_number_ = 0;
+  skipped_lines_ = 0;
+}
+
+CReplayLogReader::~CReplayLogReader(void)
+{
+  close();
+}
+
+bool CReplayLogReader::open(const std::string& path)
+{
+  close();
+  file_ = fopen(path.c_str(), "r");
+  line_number_ = 0;
+  skipped_lines_ = 0;
+  return file_ != NULL;
+}
+
+void CReplayLogReader::close(void)
+{
+  if (file_ != NULL)
+  {
+    fclose(file_);
+    file_ = NULL;
+  }
+}
+
+bool CReplayLogReader::next(ekf::ReplayEvent& event)
+{
+  char line[512];
+
+  while (file_ != NULL && fgets(line, sizeof(line), file_) != NULL)
+  {
+    line_number_++;
+
+    if (line[0] == '#' || line[0] == '\n' || line[0] == '\r' || line[0] == '\0')
+      continue;
+    if (line_number_ == 1 && strncmp(line, "stamp", 5) == 0)
+      continue;
+
+    if (parseLine(line, event))
+      return true;
+
+    skipped_lines_++;
+  }
+  return false;
+}
+
+bool CReplayLogReader::parseLine(char* line, ekf::ReplayEvent& event)
+{
+  char* cursor = line;
+  char* end;
+
+  event.stamp = strtod(cursor, &end);
+  if (end == cursor || *end != ',')
+    return false;
+  cursor = end + 1;
+
+  if (strncmp(cursor, "odom,", 5) == 0)
+    event.type = ekf::ReplayEvent::ODOM;
+  else if (strncmp(cursor, "gnss,", 5) == 0)
+    event.type = ekf::ReplayEvent::GNSS;
+  else if (strncmp(cursor, "init,", 5) == 0)
+    event.type = ekf::ReplayEvent::INIT;
+  else
+    return false;
+  cursor += 5;
+
+  double* fields[8] = {&event.x, &event.y, &event.theta, &event.vx, &event.vy, &event.var_x, &event.var_y,
+                       &event.var_theta};
+  for (int i = 0; i < 8; i++)
+  {
+    *fields[i] = strtod(cursor, &end);
+    if (end == cursor)
+    {
+      // empty column
+      if (i < 3)
+        return false;
+      *fields[i] = 0.0;
+    }
+    cursor = end;
+    if (*cursor == ',')
+      cursor++;
+  }
+  return true;
+}
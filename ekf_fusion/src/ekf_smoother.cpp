@@ -0,0 +1,127 @@
+#include "ekf_smoother.h"
+#include "ekf.h"
+
+namespace
+{
+
+void packCovariance(const Eigen::Matrix<double, 3, 3>& covariance, double* packed)
+{
+  packed[0] = covariance(0, 0);
+  packed[1] = covariance(0, 1);
+  packed[2] = covariance(0, 2);
+  packed[3] = covariance(1, 1);
+  packed[4] = covariance(1, 2);
+  packed[5] = covariance(2, 2);
+}
+
+void unpackCovariance(const double* packed, Eigen::Matrix<double, 3, 3>& covariance)
+{
+  covariance << packed[0], packed[1], packed[2],
+                packed[1], packed[3], packed[4],
+                packed[2], packed[4], packed[5];
+}
+
+double wrapAngle(double angle)
+{
+  if (angle > PI)
+    return angle - 2 * PI;
+  else if (angle < -1 * PI)
+    return angle + 2 * PI;
+  return angle;
+}
+
+}
+
+CEkfSmoother::CEkfSmoother(size_t chunk_size, size_t lookahead)
+{
+  chunk_size_ = chunk_size > 0 ? chunk_size : 1;
+  lookahead_ = lookahead;
+  steps_.reserve(chunk_size_ + lookahead_);
+}
+
+CEkfSmoother::~CEkfSmoother(void)
+{
+}
+
+void CEkfSmoother::addStep(double stamp, const Eigen::Matrix<double, 3, 1>& state,
+                           const Eigen::Matrix<double, 3, 3>& covariance)
+{
+  if (steps_.size() == chunk_size_ + lookahead_)
+    smooth(chunk_size_);
+
+  Step step;
+  step.stamp = stamp;
+  for (int i = 0; i < 3; i++)
+  {
+    step.predicted[i] = state(i);
+    step.filtered[i] = state(i);
+  }
+  packCovariance(covariance, step.predicted_covariance);
+  packCovariance(covariance, step.filtered_covariance);
+  steps_.push_back(step);
+}
+
+void CEkfSmoother::updateStep(const Eigen::Matrix<double, 3, 1>& state, const Eigen::Matrix<double, 3, 3>& covariance)
+{
+  if (steps_.empty())
+    return;
+
+  Step& step = steps_.back();
+  for (int i = 0; i < 3; i++)
+    step.filtered[i] = state(i);
+  packCovariance(covariance, step.filtered_covariance);
+}
+
+void CEkfSmoother::endSegment(void)
+{
+  smooth(steps_.size());
+}
+
+void CEkfSmoother::smooth(size_t n_emit)
+{
+  if (steps_.empty())
+    return;
+
+  size_t first_output = output_.size();
+  output_.resize(first_output + n_emit);
+
+  // the newest step has no future information, smoothed = filtered
+  size_t k = steps_.size() - 1;
+  Eigen::Matrix<double, 3, 1> state(steps_[k].filtered);
+  Eigen::Matrix<double, 3, 3> covariance;
+  unpackCovariance(steps_[k].filtered_covariance, covariance);
+  if (k < n_emit)
+  {
+    output_[first_output + k].stamp = steps_[k].stamp;
+    output_[first_output + k].state = state;
+    output_[first_output + k].covariance = covariance;
+  }
+
+  Eigen::Matrix<double, 3, 3> filtered_covariance, predicted_covariance;
+  while (k-- > 0)
+  {
+    const Step& step = steps_[k];
+    const Step& next = steps_[k + 1];
+    unpackCovariance(step.filtered_covariance, filtered_covariance);
+    unpackCovariance(next.predicted_covariance, predicted_covariance);
+
+    // smoother gain C = P_f(k) * P_p(k+1)^-1, both symmetric: C^T = P_p(k+1)^-1 * P_f(k)
+    Eigen::Matrix<double, 3, 3> gain = predicted_covariance.ldlt().solve(filtered_covariance).transpose();
+
+    Eigen::Matrix<double, 3, 1> correction = state - Eigen::Matrix<double, 3, 1>(next.predicted);
+    correction(2) = wrapAngle(correction(2));
+    state = Eigen::Matrix<double, 3, 1>(step.filtered) + gain * correction;
+    state(2) = wrapAngle(state(2));
+    covariance = filtered_covariance + gain * (covariance - predicted_covariance) * gain.transpose();
+
+    if (k < n_emit)
+    {
+      output_[first_output + k].stamp = step.stamp;
+      output_[first_output + k].state = state;
+      output_[first_output + k].covariance = covariance;
+    }
+  }
+
+  // the lookahead steps go on with the next chunk
+  steps_.erase(steps_.begin(), steps_.begin() + n_emit);
+}
@@ -0,0 +1,91 @@
+#include <chrono>
+#include "ekf_transform_broadcaster.h"
+
+CTransformBroadcaster::CTransformBroadcaster(const std::string& frame_id, const std::string& child_id, double rate)
+{
+  frame_id_ = frame_id;
+  child_id_ = child_id;
+  rate_ = rate > 0.0 ? rate : 50.0;
+
+  stop_ = false;
+  has_transform_ = false;
+  pending_updates_ = 0;
+  coalesced_updates_ = 0;
+  map2odom_.setIdentity();
+
+  thread_ = std::thread(&CTransformBroadcaster::broadcastThread, this);
+}
+
+CTransformBroadcaster::~CTransformBroadcaster(void)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_condition_.notify_all();
+  thread_.join();
+}
+
+void CTransformBroadcaster::setMapToOdom(const Eigen::Isometry3d& map2odom)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  map2odom_ = map2odom;
+  has_transform_ = true;
+  pending_updates_++;
+}
+
+size_t CTransformBroadcaster::getCoalescedUpdates(void)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return coalesced_updates_;
+}
+
+void CTransformBroadcaster::broadcastThread(void)
+{
+  std::chrono::steady_clock::duration period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(1.0 / rate_));
+  std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+
+  geometry_msgs::TransformStamped odom_to_map;
+  odom_to_map.header.frame_id = frame_id_;
+  odom_to_map.child_frame_id = child_id_;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_)
+  {
+    next += period;
+    if (stop_condition_.wait_until(lock, next, [this]
+    { return stop_;}))
+      break;
+
+    // a late tick (the thread was descheduled) is not made up for
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (next < now)
+      next = now;
+
+    if (!has_transform_)
+      continue;
+
+    if (pending_updates_ > 1)
+      coalesced_updates_ += pending_updates_ - 1;
+    pending_updates_ = 0;
+    Eigen::Isometry3d map2odom = map2odom_;
+    // stamped with the copy: a later setMapToOdom can not be older than what is sent
+    odom_to_map.header.stamp = ros::Time::now();
+
+    // the transform is sent without holding the lock, the callbacks never wait on it
+    lock.unlock();
+
+    Eigen::Quaterniond quat_final(map2odom.linear());
+    odom_to_map.transform.translation.x = map2odom.translation()(0);
+    odom_to_map.transform.translation.y = map2odom.translation()(1);
+    odom_to_map.transform.translation.z = map2odom.translation()(2);
+    odom_to_map.transform.rotation.x = quat_final.x();
+    odom_to_map.transform.rotation.y = quat_final.y();
+    odom_to_map.transform.rotation.z = quat_final.z();
+    odom_to_map.transform.rotation.w = quat_final.w();
+    broadcaster_.sendTransform(odom_to_map);
+
+    lock.lock();
+  }
+}
@@ -0,0 +1,59 @@
+#include <cstring>
+#include "ekf_transform_cache.h"
+
+const double CTransformCache::CLOCK_RESET_THRESHOLD = 1.0;
+
+CTransformCache::CTransformCache(void)
+{
+}
+
+CTransformCache::~CTransformCache(void)
+{
+}
+
+const char* CTransformCache::frameName(const std::string& frame)
+{
+  const char* name = frame.c_str();
+  return name[0] == '/' ? name + 1 : name;
+}
+
+size_t CTransformCache::addEdge(const std::string& parent, const std::string& child)
+{
+  Edge edge;
+  edge.parent = frameName(parent);
+  edge.child = frameName(child);
+  edge.valid = false;
+  edge.stamp = 0.0;
+  edge.transform.setIdentity();
+  edges_.push_back(edge);
+  return edges_.size() - 1;
+}
+
+bool CTransformCache::findEdge(const std::string& parent, const std::string& child, size_t& edge) const
+{
+  const char* parent_name = frameName(parent);
+  const char* child_name = frameName(child);
+
+  for (size_t i = 0; i < edges_.size(); i++)
+  {
+    if (strcmp(edges_[i].child.c_str(), child_name) == 0 && strcmp(edges_[i].parent.c_str(), parent_name) == 0)
+    {
+      edge = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+void CTransformCache::setTransform(size_t edge, double stamp, const Eigen::Isometry3d& transform)
+{
+  Edge& e = edges_[edge];
+
+  // late messages are dropped, but a large jump back is a restarted clock (bag loop)
+  if (e.valid && stamp < e.stamp && stamp > e.stamp - CLOCK_RESET_THRESHOLD)
+    return;
+
+  e.transform = transform;
+  e.stamp = stamp;
+  e.valid = true;
+}
@@ -0,0 +1,440 @@
+#include <limits>
+#include "particle_filter.h"
+
+namespace
+{
+
+const double TWO_PI = 2.0 * PI;
+const double INV_TWO_PI = 1.0 / (2.0 * PI);
+
+/**
+ * \brief Wraps the angles to [-PI, PI)
+ */
+template<class Derived>
+  void wrapAngles(Eigen::ArrayBase<Derived>& angles)
+  {
+    angles -= TWO_PI * ((angles + PI) * INV_TWO_PI).floor();
+  }
+
+// adding and subtracting 1.5 * 2^52 rounds to the nearest integer (|x| < 2^51) with
+// plain arithmetic, which Eigen vectorises (round and floor need SSE4.1, and the
+// bool to double cast of a comparison is scalar)
+const double ROUNDING_CONSTANT = 6755399441055744.0;
+
+/**
+ * \brief Vectorised wrap to [-PI, PI]
+ */
+template<class Derived>
+  void wrapAnglesFast(Eigen::ArrayBase<Derived>& angles)
+  {
+    angles -= TWO_PI * ((angles * INV_TWO_PI + ROUNDING_CONSTANT) - ROUNDING_CONSTANT);
+  }
+
+/**
+ * \brief Vectorised sine and cosine of angles in [-PI, PI] (Eigen only vectorises them in float)
+ *
+ * With k = round(x / PI), y = x - k PI is in [-PI/2, PI/2] and sin(x), cos(x) are
+ * (-1)^k sin(y), (-1)^k cos(y); the Taylor series are evaluated up to y^17 and
+ * y^18, the absolute error is below 1e-11.
+ */
+template<class Angles, class Output>
+  void sinCos(const Eigen::ArrayBase<Angles>& angles, Eigen::ArrayBase<Output>& sin_out,
+              Eigen::ArrayBase<Output>& cos_out)
+  {
+    // cos_out holds k first, then (-1)^k = 1 - 2 k^2 for k in {-1, 0, 1}; sin_out holds y
+    cos_out = (angles * (1.0 / PI) + ROUNDING_CONSTANT) - ROUNDING_CONSTANT;
+    sin_out = angles - PI * cos_out;
+    cos_out = 1.0 - 2.0 * cos_out.square();
+
+    const double s3 = -1.0 / 6.0, s5 = 1.0 / 120.0, s7 = -1.0 / 5040.0, s9 = 1.0 / 362880.0;
+    const double s11 = -1.0 / 39916800.0, s13 = 1.0 / 6227020800.0, s15 = -1.0 / 1307674368000.0;
+    const double s17 = 1.0 / 355687428096000.0;
+    const double c2 = -1.0 / 2.0, c4 = 1.0 / 24.0, c6 = -1.0 / 720.0, c8 = 1.0 / 40320.0, c10 = -1.0 / 3628800.0;
+    const double c12 = 1.0 / 479001600.0, c14 = -1.0 / 87178291200.0, c16 = 1.0 / 20922789888000.0;
+    const double c18 = -1.0 / 6402373705728000.0;
+
+    cos_out *= 1.0
+        + sin_out.square()
+            * (c2 + sin_out.square() * (c4 + sin_out.square() * (c6 + sin_out.square() * (c8
+                + sin_out.square() * (c10 + sin_out.square() * (c12 + sin_out.square() * (c14
+                    + sin_out.square() * (c16 + sin_out.square() * c18))))))));
+    sin_out *= (1.0 - 2.0 * ((angles * (1.0 / PI) + ROUNDING_CONSTANT) - ROUNDING_CONSTANT).square())
+        * (1.0 + sin_out.square()
+            * (s3 + sin_out.square() * (s5 + sin_out.square() * (s7 + sin_out.square() * (s9
+                + sin_out.square() * (s11 + sin_out.square() * (s13 + sin_out.square() * (s15
+                    + sin_out.square() * s17))))))));
+  }
+
+double wrapAngle(double angle)
+{
+  return angle - TWO_PI * floor((angle + PI) * INV_TWO_PI);
+}
+
+}
+
+CParticleFilter::CParticleFilter(ekf::KalmanConfiguration kalman_configuration,
+                                 ekf::ParticleFilterConfiguration particle_configuration)
+{
+  config_ = kalman_configuration;
+  particle_config_ = particle_configuration;
+
+  initialised_ = false;
+  size_ = particle_config_.n_particles > 0 ? particle_config_.n_particles : 1;
+
+  x_.resize(size_);
+  y_.resize(size_);
+  theta_.resize(size_);
+  weight_.resize(size_);
+  x_new_.resize(size_);
+  y_new_.resize(size_);
+  theta_new_.resize(size_);
+  log_likelihood_.resize(size_);
+
+  std::normal_distribution<double> normal(0.0, 1.0);
+  noise_.resize(NOISE_TABLE_SIZE + size_);
+  for (size_t i = 0; i < noise_.size(); i++)
+    noise_[i] = normal(random_);
+
+  if (particle_config_.n_threads > 1)
+  {
+    pool_ = new CThreadPool(particle_config_.n_threads);
+    n_chunks_ = particle_config_.n_threads;
+  }
+  else
+  {
+    pool_ = NULL;
+    n_chunks_ = 1;
+  }
+  chunk_values_.resize(n_chunks_ * 6);
+
+  // same prior as CEkf
+  Eigen::Matrix<double, 3, 1> state = Eigen::Matrix<double, 3, 1>::Zero();
+  Eigen::Matrix<double, 3, 3> covariance = Eigen::Matrix<double, 3, 3>::Zero();
+  covariance(0, 0) = pow(config_.x_ini, 2);
+  covariance(1, 1) = pow(config_.y_ini, 2);
+  covariance(2, 2) = pow(config_.theta_ini, 2);
+  sample(state, covariance);
+}
+
+CParticleFilter::~CParticleFilter(void)
+{
+  delete pool_;
+}
+
+size_t CParticleFilter::noiseOffset(void)
+{
+  std::uniform_int_distribution<size_t> offset(0, NOISE_TABLE_SIZE);
+  return offset(random_);
+}
+
+void CParticleFilter::sample(const Eigen::Matrix<double, 3, 1>& mean, const Eigen::Matrix<double, 3, 3>& covariance)
+{
+  // x = mean + L * n, with L the Cholesky factor (or the deviations if it is not definite)
+  Eigen::Matrix<double, 3, 3> L = Eigen::Matrix<double, 3, 3>::Zero();
+  Eigen::LLT<Eigen::Matrix<double, 3, 3> > llt(covariance);
+  if (llt.info() == Eigen::Success)
+    L = llt.matrixL();
+  else
+    for (int i = 0; i < 3; i++)
+      L(i, i) = sqrt(std::max(covariance(i, i), 0.0));
+
+  const size_t offset_1 = noiseOffset();
+  const size_t offset_2 = noiseOffset();
+  const size_t offset_3 = noiseOffset();
+  const double weight = 1.0 / size_;
+
+  auto kernel = [&](size_t chunk)
+  {
+    size_t begin = chunkBegin(chunk);
+    size_t n = chunkEnd(chunk) - begin;
+    LaneMap x(x_.data() + begin, n), y(y_.data() + begin, n), theta(theta_.data() + begin, n);
+    LaneMap w(weight_.data() + begin, n);
+    LaneMap n_1(noise_.data() + offset_1 + begin, n), n_2(noise_.data() + offset_2 + begin, n);
+    LaneMap n_3(noise_.data() + offset_3 + begin, n);
+
+    x = mean(0) + L(0, 0) * n_1;
+    y = mean(1) + L(1, 0) * n_1 + L(1, 1) * n_2;
+    theta = mean(2) + L(2, 0) * n_1 + L(2, 1) * n_2 + L(2, 2) * n_3;
+    wrapAngles(theta);
+    w.setConstant(weight);
+  };
+  if (pool_ != NULL)
+    pool_->run(n_chunks_, kernel);
+  else
+    kernel(0);
+
+  summary_valid_ = false;
+}
+
+void CParticleFilter::predict(ekf::OdomAction act, unsigned int n_steps)
+{
+  if (!initialised_)
+    return;
+
+  // per step noise with the CEkf process noise deviations
+  const double scale = sqrt(static_cast<double>(n_steps));
+  const double sigma_x = config_.x_model * scale;
+  const double sigma_y = config_.y_model * scale;
+  const double sigma_theta = config_.theta_model * scale;
+
+  const size_t offset_x = noiseOffset();
+  const size_t offset_y = noiseOffset();
+  const size_t offset_theta = noiseOffset();
+
+  auto kernel = [&](size_t chunk)
+  {
+    size_t begin = chunkBegin(chunk);
+    size_t n = chunkEnd(chunk) - begin;
+    LaneMap x(x_.data() + begin, n), y(y_.data() + begin, n), theta(theta_.data() + begin, n);
+
+    x += act.delta_x + sigma_x * LaneMap(noise_.data() + offset_x + begin, n);
+    y += act.delta_y + sigma_y * LaneMap(noise_.data() + offset_y + begin, n);
+    theta += act.delta_theta + sigma_theta * LaneMap(noise_.data() + offset_theta + begin, n);
+    wrapAnglesFast(theta);
+  };
+  if (pool_ != NULL)
+    pool_->run(n_chunks_, kernel);
+  else
+    kernel(0);
+
+  summary_valid_ = false;
+}
+
+double CParticleFilter::update(ekf::GnssObservation obs)
+{
+  const double INVALID_DISTANCE = -1.0;
+
+  if (!initialised_)
+  {
+    Eigen::Matrix<double, 3, 1> state(obs.x, obs.y, obs.theta);
+    Eigen::Matrix<double, 3, 3> covariance = Eigen::Matrix<double, 3, 3>::Zero();
+    covariance(0, 0) = obs.sigma_x;
+    covariance(1, 1) = obs.sigma_y;
+    covariance(2, 2) = obs.sigma_theta;
+    sample(state, covariance);
+
+    // the fix heading may be reversed, keep that hypothesis too
+    size_t n_reversed = static_cast<size_t>(particle_config_.reverse_heading_weight * size_ + 0.5);
+    for (size_t i = 0; i < n_reversed && i < size_; i++)
+      theta_[i] = wrapAngle(theta_[i] + PI);
+
+    return INVALID_DISTANCE;
+  }
+
+  const double w_reverse = particle_config_.reverse_heading_weight;
+
+  // outlier gate on the Gaussian summary, as CEkf
+  updateSummary();
+  Eigen::Matrix<double, 3, 1> z;
+  z(0) = obs.x - mean_(0);
+  z(1) = obs.y - mean_(1);
+  z(2) = wrapAngle(obs.theta - mean_(2));
+  if (w_reverse > 0.0 && fabs(wrapAngle(z(2) + PI)) < fabs(z(2)))
+    z(2) = wrapAngle(z(2) + PI);
+  Eigen::Matrix<double, 3, 3> S = covariance_;
+  S(0, 0) += obs.sigma_x;
+  S(1, 1) += obs.sigma_y;
+  S(2, 2) += obs.sigma_theta;
+  Eigen::LDLT<Eigen::Matrix<double, 3, 3> > ldlt(S);
+  double mahalanobis_distance = sqrt(z.dot(ldlt.solve(z)));
+  double likelihood = exp(-0.5 * mahalanobis_distance) / sqrt(ldlt.vectorD().prod());
+  if (!(mahalanobis_distance < config_.outlier_mahalanobis_threshold))
+    return likelihood;
+
+  const double inv_sigma_x = 1.0 / obs.sigma_x;
+  const double inv_sigma_y = 1.0 / obs.sigma_y;
+  const double inv_sigma_theta = 1.0 / obs.sigma_theta;
+
+  // per particle log-likelihood (x_new_ and y_new_ are scratch lanes here)
+  auto likelihood_kernel = [&](size_t chunk)
+  {
+    size_t begin = chunkBegin(chunk);
+    size_t n = chunkEnd(chunk) - begin;
+    if (n == 0)
+    {
+      chunk_values_[chunk] = -std::numeric_limits<double>::infinity();
+      return;
+    }
+    LaneMap x(x_.data() + begin, n), y(y_.data() + begin, n), theta(theta_.data() + begin, n);
+    LaneMap ll(log_likelihood_.data() + begin, n), d_reverse(x_new_.data() + begin, n);
+    LaneMap position(y_new_.data() + begin, n);
+
+    position = (x - obs.x).square() * inv_sigma_x + (y - obs.y).square() * inv_sigma_y;
+
+    ll = theta - wrapAngle(obs.theta);
+    wrapAnglesFast(ll);
+    if (w_reverse > 0.0)
+    {
+      // heading mixture (1 - w) N(theta) + w N(theta + PI), as a log-sum-exp
+      d_reverse = ll + PI;
+      wrapAnglesFast(d_reverse);
+      ll = ll.square() * inv_sigma_theta;
+      d_reverse = d_reverse.square() * inv_sigma_theta;
+      ll = -0.5 * (position + ll.min(d_reverse))
+          + ((1.0 - w_reverse) * (-0.5 * (ll - ll.min(d_reverse))).exp()
+              + w_reverse * (-0.5 * (d_reverse - ll.min(d_reverse))).exp()).log();
+    }
+    else
+    {
+      ll = -0.5 * (position + ll.square() * inv_sigma_theta);
+    }
+    chunk_values_[chunk] = ll.maxCoeff();
+  };
+  if (pool_ != NULL)
+    pool_->run(n_chunks_, likelihood_kernel);
+  else
+    likelihood_kernel(0);
+
+  double max_ll = chunk_values_[0];
+  for (size_t c = 1; c < n_chunks_; c++)
+    max_ll = std::max(max_ll, chunk_values_[c]);
+
+  auto weight_kernel = [&](size_t chunk)
+  {
+    size_t begin = chunkBegin(chunk);
+    size_t n = chunkEnd(chunk) - begin;
+    LaneMap w(weight_.data() + begin, n), ll(log_likelihood_.data() + begin, n);
+    w *= (ll - max_ll).exp();
+    chunk_values_[chunk] = w.sum();
+  };
+  if (pool_ != NULL)
+    pool_->run(n_chunks_, weight_kernel);
+  else
+    weight_kernel(0);
+
+  double sum = 0.0;
+  for (size_t c = 0; c < n_chunks_; c++)
+    sum += chunk_values_[c];
+
+  LaneMap w(weight_.data(), size_);
+  if (sum > 0.0 && std::isfinite(sum))
+  {
+    w *= 1.0 / sum;
+  }
+  else
+  {
+    // every weight underflowed, restart from the likelihood alone
+    w = (LaneMap(log_likelihood_.data(), size_) - max_ll).exp();
+    w /= w.sum();
+  }
+
+  if (getEffectiveSampleSize() < particle_config_.resampling_threshold * size_)
+    resample();
+
+  summary_valid_ = false;
+  return likelihood;
+}
+
+void CParticleFilter::resample(void)
+{
+  // systematic resampling
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  const double step = 1.0 / size_;
+  double target = uniform(random_) * step;
+  double cumulative = weight_[0];
+  size_t j = 0;
+  for (size_t i = 0; i < size_; i++)
+  {
+    while (target > cumulative && j + 1 < size_)
+    {
+      j++;
+      cumulative += weight_[j];
+    }
+    x_new_[i] = x_[j];
+    y_new_[i] = y_[j];
+    theta_new_[i] = theta_[j];
+    target += step;
+  }
+
+  x_.swap(x_new_);
+  y_.swap(y_new_);
+  theta_.swap(theta_new_);
+  LaneMap(weight_.data(), size_).setConstant(step);
+}
+
+double CParticleFilter::getEffectiveSampleSize(void)
+{
+  return 1.0 / LaneMap(weight_.data(), size_).square().sum();
+}
+
+void CParticleFilter::updateSummary(void)
+{
+  if (summary_valid_)
+    return;
+
+  // weighted mean, circular for the heading
+  auto mean_kernel = [&](size_t chunk)
+  {
+    size_t begin = chunkBegin(chunk);
+    size_t n = chunkEnd(chunk) - begin;
+    LaneMap x(x_.data() + begin, n), y(y_.data() + begin, n), theta(theta_.data() + begin, n);
+    LaneMap w(weight_.data() + begin, n);
+    LaneMap sin_theta(x_new_.data() + begin, n), cos_theta(y_new_.data() + begin, n);
+    sinCos(theta, sin_theta, cos_theta);
+    double* values = chunk_values_.data() + 6 * chunk;
+    values[0] = (w * x).sum();
+    values[1] = (w * y).sum();
+    values[2] = (w * cos_theta).sum();
+    values[3] = (w * sin_theta).sum();
+  };
+  if (pool_ != NULL)
+    pool_->run(n_chunks_, mean_kernel);
+  else
+    mean_kernel(0);
+
+  double sums[4] = {0.0, 0.0, 0.0, 0.0};
+  for (size_t c = 0; c < n_chunks_; c++)
+    for (int k = 0; k < 4; k++)
+      sums[k] += chunk_values_[6 * c + k];
+  mean_(0) = sums[0];
+  mean_(1) = sums[1];
+  mean_(2) = atan2(sums[3], sums[2]);
+
+  auto covariance_kernel = [&](size_t chunk)
+  {
+    size_t begin = chunkBegin(chunk);
+    size_t n = chunkEnd(chunk) - begin;
+    LaneMap x(x_.data() + begin, n), y(y_.data() + begin, n), theta(theta_.data() + begin, n);
+    LaneMap w(weight_.data() + begin, n);
+    LaneMap d_theta(log_likelihood_.data() + begin, n);
+    d_theta = theta - mean_(2);
+    wrapAnglesFast(d_theta);
+    double* values = chunk_values_.data() + 6 * chunk;
+    values[0] = (w * (x - mean_(0)).square()).sum();
+    values[1] = (w * (x - mean_(0)) * (y - mean_(1))).sum();
+    values[2] = (w * (x - mean_(0)) * d_theta).sum();
+    values[3] = (w * (y - mean_(1)).square()).sum();
+    values[4] = (w * (y - mean_(1)) * d_theta).sum();
+    values[5] = (w * d_theta.square()).sum();
+  };
+  if (pool_ != NULL)
+    pool_->run(n_chunks_, covariance_kernel);
+  else
+    covariance_kernel(0);
+
+  double moments[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+  for (size_t c = 0; c < n_chunks_; c++)
+    for (int k = 0; k < 6; k++)
+      moments[k] += chunk_values_[6 * c + k];
+  covariance_(0, 0) = moments[0];
+  covariance_(0, 1) = covariance_(1, 0) = moments[1];
+  covariance_(0, 2) = covariance_(2, 0) = moments[2];
+  covariance_(1, 1) = moments[3];
+  covariance_(1, 2) = covariance_(2, 1) = moments[4];
+  covariance_(2, 2) = moments[5];
+
+  summary_valid_ = true;
+}
+
+void CParticleFilter::getStateAndCovariance(Eigen::Matrix<double, 3, 1>& state,
+                                            Eigen::Matrix<double, 3, 3>& covariance)
+{
+  updateSummary();
+  state = mean_;
+  covariance = covariance_;
+}
+
+void CParticleFilter::setStateAndCovariance(Eigen::Matrix<double, 3, 1> state, Eigen::Matrix<double, 3, 3> covariance)
+{
+  sample(state, covariance);
+}
@@ -0,0 +1,119 @@
+#include <cmath>
+#include "pose_history.h"
+
+const double CPoseHistory::CLOCK_RESET_THRESHOLD = 1.0;
+
+CPoseHistory::CPoseHistory(size_t capacity)
+{
+  samples_.resize(capacity > 0 ? capacity : 1);
+  head_ = 0;
+  count_ = 0;
+}
+
+CPoseHistory::~CPoseHistory(void)
+{
+}
+
+void CPoseHistory::add(double stamp, const ekf::Pose2D& pose)
+{
+  if (count_ > 0)
+  {
+    double newest = sampleAt(count_ - 1).stamp;
+    if (stamp < newest - CLOCK_RESET_THRESHOLD)
+      clear();
+    else if (stamp < newest)
+      return;
+    else if (stamp == newest)
+      count_--;
+  }
+
+  Sample sample;
+  sample.stamp = stamp;
+  sample.pose = pose;
+  if (count_ < samples_.size())
+  {
+    samples_[(head_ + count_) % samples_.size()] = sample;
+    count_++;
+  }
+  else
+  {
+    samples_[head_] = sample;
+    head_ = (head_ + 1) % samples_.size();
+  }
+}
+
+bool CPoseHistory::getPose(double stamp, ekf::Pose2D& pose) const
+{
+  if (count_ == 0 || stamp < sampleAt(0).stamp || stamp > sampleAt(count_ - 1).stamp)
+    return false;
+
+  // first sample with stamp >= the requested one
+  size_t first = 0;
+  size_t last = count_ - 1;
+  while (first < last)
+  {
+    size_t middle = first + (last - first) / 2;
+    if (sampleAt(middle).stamp < stamp)
+      first = middle + 1;
+    else
+      last = middle;
+  }
+
+  const Sample& end = sampleAt(first);
+  if (first == 0 || end.stamp == stamp)
+  {
+    pose = end.pose;
+    return true;
+  }
+
+  const Sample& start = sampleAt(first - 1);
+  pose = interpolate(start.pose, end.pose, (stamp - start.stamp) / (end.stamp - start.stamp));
+  return true;
+}
+
+ekf::Pose2D CPoseHistory::interpolate(const ekf::Pose2D& start, const ekf::Pose2D& end, double fraction)
+{
+  // step in the start frame
+  double cos_start = cos(start.theta);
+  double sin_start = sin(start.theta);
+  double dx = cos_start * (end.x - start.x) + sin_start * (end.y - start.y);
+  double dy = -sin_start * (end.x - start.x) + cos_start * (end.y - start.y);
+  double dtheta = atan2(sin(end.theta - start.theta), cos(end.theta - start.theta));
+
+  // log: translation of the step as the arc (rho) travelled with constant yaw rate
+  double a, b; // sin(t) / t and (1 - cos(t)) / t
+  if (fabs(dtheta) < 1e-9)
+  {
+    a = 1.0;
+    b = 0.5 * dtheta;
+  }
+  else
+  {
+    a = sin(dtheta) / dtheta;
+    b = (1.0 - cos(dtheta)) / dtheta;
+  }
+  double det = a * a + b * b;
+  double rho_x = (a * dx + b * dy) / det;
+  double rho_y = (-b * dx + a * dy) / det;
+
+  // exp of the scaled step
+  double theta = fraction * dtheta;
+  if (fabs(theta) < 1e-9)
+  {
+    a = 1.0;
+    b = 0.5 * theta;
+  }
+  else
+  {
+    a = sin(theta) / theta;
+    b = (1.0 - cos(theta)) / theta;
+  }
+  double step_x = fraction * (a * rho_x - b * rho_y);
+  double step_y = fraction * (b * rho_x + a * rho_y);
+
+  ekf::Pose2D pose;
+  pose.x = start.x + cos_start * step_x - sin_start * step_y;
+  pose.y = start.y + sin_start * step_x + cos_start * step_y;
+  pose.theta = atan2(sin(start.theta + theta), cos(start.theta + theta));
+  return pose;
+}
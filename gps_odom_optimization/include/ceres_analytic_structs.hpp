@@ -0,0 +1,230 @@
+#ifndef CERES_ANALYTIC_STRUCTS_H
+#define CERES_ANALYTIC_STRUCTS_H
+#pragma once
+#include "common_types.hpp"
+#include "ceres/ceres.h"
+
+/*
+ * Hand-derived versions of the cost functions of ceres_structs.hpp. The residuals are the same
+ * polynomials of the parameters as in the templated functors, so the jacobians match the autodiff
+ * ones to rounding. Quaternions are in Eigen order (x, y, z, w) and the jacobians are taken with
+ * respect to the 4 coefficients, the local parameterization is applied by Ceres on top.
+ */
+namespace analytic {
+
+using RowMajor34 = Eigen::Matrix<double, 3, 4, Eigen::RowMajor>;
+using RowMajor44 = Eigen::Matrix<double, 4, 4, Eigen::RowMajor>;
+
+/**
+ * @brief Jacobian of R(q) * v with respect to the quaternion coefficients (x, y, z, w)
+ */
+inline RowMajor34 rotatedPointJacobian(const Eigen::Quaterniond& q, const Eigen::Vector3d& v) {
+    const double x = q.x(), y = q.y(), z = q.z(), w = q.w();
+    const double a = v.x(), b = v.y(), c = v.z();
+    RowMajor34 jacobian;
+    jacobian << 2.0 * (y * b + z * c), 2.0 * (x * b + w * c) - 4.0 * y * a,
+                2.0 * (x * c - w * b) - 4.0 * z * a, 2.0 * (y * c - z * b),
+                2.0 * (y * a - w * c) - 4.0 * x * b, 2.0 * (x * a + z * c),
+                2.0 * (w * a + y * c) - 4.0 * z * b, 2.0 * (z * a - x * c),
+                2.0 * (z * a + w * b) - 4.0 * x * c, 2.0 * (z * b - w * a) - 4.0 * y * c,
+                2.0 * (x * a + y * b), 2.0 * (x * b - y * a);
+    return jacobian;
+}
+
+/**
+ * @brief Matrix of the left product: p * q = leftProduct(p) * q
+ */
+inline RowMajor44 leftProduct(const Eigen::Quaterniond& p) {
+    RowMajor44 product;
+    product <<  p.w(), -p.z(),  p.y(), p.x(),
+                p.z(),  p.w(), -p.x(), p.y(),
+               -p.y(),  p.x(),  p.w(), p.z(),
+               -p.x(), -p.y(), -p.z(), p.w();
+    return product;
+}
+
+/**
+ * @brief Matrix of the right product: p * q = rightProduct(q) * p
+ */
+inline RowMajor44 rightProduct(const Eigen::Quaterniond& q) {
+    RowMajor44 product;
+    product <<  q.w(),  q.z(), -q.y(), q.x(),
+               -q.z(),  q.w(),  q.x(), q.y(),
+                q.y(), -q.x(),  q.w(), q.z(),
+               -q.x(), -q.y(), -q.z(), q.w();
+    return product;
+}
+
+/**
+ * @brief: points cost function, r = I * (R(q) * det + p - lm)
+ */
+class PointsErrorTerm : public ceres::SizedCostFunction<3, 3, 4> {
+public:
+    PointsErrorTerm(const Eigen::Vector3d& det, const Eigen::Vector3d& lm, const Eigen::Matrix<double, 3, 3>& information)
+            : det_(det), lm_(lm), information_(information) {
+    }
+
+    bool Evaluate(double const* const* parameters, double* residuals_ptr, double** jacobians) const override {
+        Eigen::Map<const Eigen::Vector3d> p(parameters[0]);
+        Eigen::Map<const Eigen::Quaterniond> q(parameters[1]);
+
+        Eigen::Map<Eigen::Vector3d> residuals(residuals_ptr);
+        residuals = information_ * (q.toRotationMatrix() * det_ + p - lm_);
+
+        if (jacobians == NULL) {
+            return true;
+        }
+        if (jacobians[0] != NULL) {
+            Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>> jacobian(jacobians[0]);
+            jacobian = information_;
+        }
+        if (jacobians[1] != NULL) {
+            Eigen::Map<RowMajor34> jacobian(jacobians[1]);
+            jacobian = information_ * rotatedPointJacobian(q, det_);
+        }
+        return true;
+    }
+
+    static ceres::CostFunction* Create(const Eigen::Vector3d& det,
+                                       const Eigen::Vector3d& lm,
+                                       const Eigen::Matrix<double, 3, 3>& information) {
+        return new PointsErrorTerm(det, lm, information);
+    }
+
+    void set(const Eigen::Vector3d& det, const Eigen::Vector3d& lm, const Eigen::Matrix<double, 3, 3>& information) {
+        det_ = det;
+        lm_ = lm;
+        information_ = information;
+    }
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+    Eigen::Vector3d det_;
+    Eigen::Vector3d lm_;
+    Eigen::Matrix<double, 3, 3> information_;
+};
+
+/**
+ * @brief: Odometry cost function, r = I * [R(q_a)^T * (p_b - p_a) - tf_p; vec(tf_q * conj(q_b) * q_a)]
+ */
+class OdometryErrorTerm : public ceres::SizedCostFunction<6, 3, 4, 3, 4> {
+public:
+    OdometryErrorTerm(const Eigen::Vector3d tf_p, const Eigen::Quaterniond tf_q, const Eigen::Matrix<double, 6, 6>& information)
+            : tf_p_(tf_p), tf_q_(tf_q), information_(information) {
+    }
+
+    bool Evaluate(double const* const* parameters, double* residuals_ptr, double** jacobians) const override {
+        Eigen::Map<const Eigen::Vector3d> p_a(parameters[0]);
+        Eigen::Map<const Eigen::Quaterniond> q_a(parameters[1]);
+        Eigen::Map<const Eigen::Vector3d> p_b(parameters[2]);
+        Eigen::Map<const Eigen::Quaterniond> q_b(parameters[3]);
+
+        const Eigen::Quaterniond q_a_inverse = q_a.conjugate();
+        const Eigen::Vector3d p_ab = p_b - p_a;
+        const Eigen::Matrix3d r_a_inverse = q_a_inverse.toRotationMatrix();
+        const Eigen::Quaterniond tf_q_b_inverse = tf_q_ * q_b.conjugate();
+        const Eigen::Quaterniond delta_q = tf_q_b_inverse * q_a;
+
+        Eigen::Matrix<double, 6, 1> error;
+        error.head<3>() = r_a_inverse * p_ab - tf_p_;
+        error.tail<3>() = delta_q.vec();
+        Eigen::Map<Eigen::Matrix<double, 6, 1>> residuals(residuals_ptr);
+        residuals = information_ * error;
+
+        if (jacobians == NULL) {
+            return true;
+        }
+        // conj(q) = conjugate * q
+        const Eigen::Vector4d conjugate(-1.0, -1.0, -1.0, 1.0);
+        if (jacobians[0] != NULL) {
+            Eigen::Map<Eigen::Matrix<double, 6, 3, Eigen::RowMajor>> jacobian(jacobians[0]);
+            jacobian = -information_.leftCols<3>() * r_a_inverse;
+        }
+        if (jacobians[1] != NULL) {
+            Eigen::Map<Eigen::Matrix<double, 6, 4, Eigen::RowMajor>> jacobian(jacobians[1]);
+            jacobian = information_.leftCols<3>() * (rotatedPointJacobian(q_a_inverse, p_ab) * conjugate.asDiagonal())
+                    + information_.rightCols<3>() * leftProduct(tf_q_b_inverse).topRows<3>();
+        }
+        if (jacobians[2] != NULL) {
+            Eigen::Map<Eigen::Matrix<double, 6, 3, Eigen::RowMajor>> jacobian(jacobians[2]);
+            jacobian = information_.leftCols<3>() * r_a_inverse;
+        }
+        if (jacobians[3] != NULL) {
+            Eigen::Map<Eigen::Matrix<double, 6, 4, Eigen::RowMajor>> jacobian(jacobians[3]);
+            jacobian = information_.rightCols<3>()
+                    * ((leftProduct(tf_q_) * rightProduct(q_a)).topRows<3>() * conjugate.asDiagonal());
+        }
+        return true;
+    }
+
+    static ceres::CostFunction* Create(const Eigen::Vector3d tf_p, const Eigen::Quaterniond tf_q,
+                                       const Eigen::Matrix<double, 6, 6>& information) {
+        return new OdometryErrorTerm(tf_p, tf_q, information);
+    }
+
+    void set(const Eigen::Vector3d& tf_p, const Eigen::Quaterniond& tf_q, const Eigen::Matrix<double, 6, 6>& information) {
+        tf_p_ = tf_p;
+        tf_q_ = tf_q;
+        information_ = information;
+    }
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+    Eigen::Vector3d tf_p_;
+    Eigen::Quaterniond tf_q_;
+    Eigen::Matrix<double, 6, 6> information_;
+};
+
+/**
+ * @brief: Prior cost function, r = I * [p_b - p; 0], the orientation is not considered
+ */
+class PriorErrorTerm : public ceres::SizedCostFunction<6, 3, 4> {
+public:
+    PriorErrorTerm(const Eigen::Vector3d p, const Eigen::Quaterniond q, const Eigen::Matrix<double, 6, 6>& information)
+            : p_(p), q_(q), information_(information) {
+    }
+
+    bool Evaluate(double const* const* parameters, double* residuals_ptr, double** jacobians) const override {
+        Eigen::Map<const Eigen::Vector3d> p_b(parameters[0]);
+
+        Eigen::Map<Eigen::Matrix<double, 6, 1>> residuals(residuals_ptr);
+        residuals = information_.leftCols<3>() * (p_b - p_);
+
+        if (jacobians == NULL) {
+            return true;
+        }
+        if (jacobians[0] != NULL) {
+            Eigen::Map<Eigen::Matrix<double, 6, 3, Eigen::RowMajor>> jacobian(jacobians[0]);
+            jacobian = information_.leftCols<3>();
+        }
+        if (jacobians[1] != NULL) {
+            Eigen::Map<Eigen::Matrix<double, 6, 4, Eigen::RowMajor>> jacobian(jacobians[1]);
+            jacobian.setZero();
+        }
+        return true;
+    }
+
+    static ceres::CostFunction* Create(const Eigen::Vector3d p, const Eigen::Quaterniond q,
+                                       const Eigen::Matrix<double, 6, 6>& information) {
+        return new PriorErrorTerm(p, q, information);
+    }
+
+    void set(const Eigen::Vector3d& p, const Eigen::Quaterniond& q, const Eigen::Matrix<double, 6, 6>& information) {
+        p_ = p;
+        q_ = q;
+        information_ = information;
+    }
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+    Eigen::Vector3d p_;
+    Eigen::Quaterniond q_;
+    Eigen::Matrix<double, 6, 6> information_;
+};
+
+} // namespace analytic
+
+#endif // CERES_ANALYTIC_STRUCTS_H
@@ -0,0 +1,170 @@
+#ifndef CERES_SE2_STRUCTS_H
+#define CERES_SE2_STRUCTS_H
+#pragma once
+#include <cmath>
+#include "common_types.hpp"
+#include "ceres/ceres.h"
+
+/*
+ * Planar versions of the cost functions of ceres_structs.hpp, used when the package is built with
+ * GPS_ODOM_SE2. A pose is one (x, y, yaw) parameter block (Pose3dWithCovariance::se2), without local
+ * parameterization, and the residuals only have the planar components. The measurements keep their
+ * 3D types: the planar rows and columns of the square root information are used (x, y and yaw).
+ * CreateMutable() and set() are the ones of ceres_structs.hpp, for a CostFunctionPool.
+ */
+
+template <typename T>
+inline T normalizeAngle(const T& angle) {
+    const T two_pi(2.0 * M_PI);
+    return angle - two_pi * ceres::floor((angle + T(M_PI)) / two_pi);
+}
+
+/**
+ * @brief: points cost function, r = I * (R(yaw) * det + t - lm) in the plane
+ */
+struct PointsErrorTermSE2 {
+    PointsErrorTermSE2(const Eigen::Vector3d& det, const Eigen::Vector3d& lm, const Eigen::Matrix<double, 3, 3>& information)
+            : det_(det.head<2>()), lm_(lm.head<2>()), information_(information.topLeftCorner<2, 2>()) {
+    }
+
+    template <typename T>
+    bool operator()(const T* pose_ptr, T* residuals_ptr) const {
+        Eigen::Matrix<T, 2, 2> r;
+        const T c = cos(pose_ptr[2]);
+        const T s = sin(pose_ptr[2]);
+        r << c, -s,
+             s,  c;
+        Eigen::Matrix<T, 2, 1> t(pose_ptr[0], pose_ptr[1]);
+
+        Eigen::Map<Eigen::Matrix<T, 2, 1>> residuals(residuals_ptr);
+        residuals = information_.template cast<T>() * (r * det_.template cast<T>() + t - lm_.template cast<T>());
+
+        return true;
+    }
+
+    static ceres::CostFunction* Create(const Eigen::Vector3d& det,
+                                       const Eigen::Vector3d& lm,
+                                       const Eigen::Matrix<double, 3, 3>& information) {
+        return new ceres::AutoDiffCostFunction<PointsErrorTermSE2, 2, 3>(new PointsErrorTermSE2(det, lm, information));
+    }
+
+    typedef PointsErrorTermSE2 Mutable;
+    static ceres::CostFunction* CreateMutable(Mutable*& term) {
+        term = new PointsErrorTermSE2(Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero(), Eigen::Matrix<double, 3, 3>::Zero());
+        return new ceres::AutoDiffCostFunction<PointsErrorTermSE2, 2, 3>(term);
+    }
+
+    void set(const Eigen::Vector3d& det, const Eigen::Vector3d& lm, const Eigen::Matrix<double, 3, 3>& information) {
+        det_ = det.head<2>();
+        lm_ = lm.head<2>();
+        information_ = information.topLeftCorner<2, 2>();
+    }
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    Eigen::Vector2d det_;
+    Eigen::Vector2d lm_;
+    Eigen::Matrix<double, 2, 2> information_;
+};
+
+/**
+ * @brief: Odometry cost function, r = I * [R(yaw_a)^T * (t_b - t_a) - tf_p; yaw_b - yaw_a - tf_yaw]
+ */
+struct OdometryErrorTermSE2 {
+    OdometryErrorTermSE2(const Eigen::Vector3d tf_p, const Eigen::Quaterniond tf_q, const Eigen::Matrix<double, 6, 6>& information) {
+        set(tf_p, tf_q, information);
+    }
+
+    template <typename T>
+    bool operator()(const T* pose_a_ptr, const T* pose_b_ptr, T* residuals_ptr) const {
+        const T c = cos(pose_a_ptr[2]);
+        const T s = sin(pose_a_ptr[2]);
+        const T dx = pose_b_ptr[0] - pose_a_ptr[0];
+        const T dy = pose_b_ptr[1] - pose_a_ptr[1];
+
+        Eigen::Matrix<T, 3, 1> error;
+        error(0) = c * dx + s * dy - T(tf_p_.x());
+        error(1) = -s * dx + c * dy - T(tf_p_.y());
+        error(2) = normalizeAngle(pose_b_ptr[2] - pose_a_ptr[2] - T(tf_yaw_));
+
+        Eigen::Map<Eigen::Matrix<T, 3, 1>> residuals(residuals_ptr);
+        residuals = information_.template cast<T>() * error;
+
+        return true;
+    }
+
+    static ceres::CostFunction* Create(const Eigen::Vector3d tf_p, const Eigen::Quaterniond tf_q,
+                                       const Eigen::Matrix<double, 6, 6>& information) {
+        return new ceres::AutoDiffCostFunction<OdometryErrorTermSE2, 3, 3, 3>(new OdometryErrorTermSE2(tf_p, tf_q, information));
+    }
+
+    typedef OdometryErrorTermSE2 Mutable;
+    static ceres::CostFunction* CreateMutable(Mutable*& term) {
+        term = new OdometryErrorTermSE2(Eigen::Vector3d::Zero(), Eigen::Quaterniond::Identity(), Eigen::Matrix<double, 6, 6>::Zero());
+        return new ceres::AutoDiffCostFunction<OdometryErrorTermSE2, 3, 3, 3>(term);
+    }
+
+    void set(const Eigen::Vector3d& tf_p, const Eigen::Quaterniond& tf_q, const Eigen::Matrix<double, 6, 6>& information) {
+        tf_p_ = tf_p.head<2>();
+        Eigen::Vector3d axis = tf_q.toRotationMatrix().col(0);
+        tf_yaw_ = atan2(axis.y(), axis.x());
+        const int planar[3] = {0, 1, 5};
+        for (int i = 0; i < 3; i++){
+            for (int j = 0; j < 3; j++){
+                information_(i, j) = information(planar[i], planar[j]);
+            }
+        }
+        // the 3D residual has vec(dq) ~ yaw / 2 where this one has the yaw: same cost for the same information
+        information_.col(2) *= 0.5;
+    }
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // The measurement for the position of B relative to A in the A frame.
+    Eigen::Vector2d tf_p_;
+    double tf_yaw_;
+    Eigen::Matrix<double, 3, 3> information_;
+};
+
+/**
+ * @brief: Prior cost function, r = I * (t - p), the orientation is not considered (as in PriorErrorTerm)
+ */
+struct PriorErrorTermSE2 {
+    PriorErrorTermSE2(const Eigen::Vector3d p, const Eigen::Matrix<double, 6, 6>& information)
+            : p_(p.head<2>()), information_(information.topLeftCorner<2, 2>()) {
+    }
+
+    template <typename T>
+    bool operator()(const T* pose_ptr, T* residuals_ptr) const {
+        Eigen::Matrix<T, 2, 1> t(pose_ptr[0], pose_ptr[1]);
+
+        Eigen::Map<Eigen::Matrix<T, 2, 1>> residuals(residuals_ptr);
+        residuals = information_.template cast<T>() * (t - p_.template cast<T>());
+
+        return true;
+    }
+
+    static ceres::CostFunction* Create(const Eigen::Vector3d p, const Eigen::Quaterniond /*q*/,
+                                       const Eigen::Matrix<double, 6, 6>& information) {
+        return new ceres::AutoDiffCostFunction<PriorErrorTermSE2, 2, 3>(new PriorErrorTermSE2(p, information));
+    }
+
+    typedef PriorErrorTermSE2 Mutable;
+    static ceres::CostFunction* CreateMutable(Mutable*& term) {
+        term = new PriorErrorTermSE2(Eigen::Vector3d::Zero(), Eigen::Matrix<double, 6, 6>::Zero());
+        return new ceres::AutoDiffCostFunction<PriorErrorTermSE2, 2, 3>(term);
+    }
+
+    // the orientation is not considered
+    void set(const Eigen::Vector3d& p, const Eigen::Quaterniond& /*q*/, const Eigen::Matrix<double, 6, 6>& information) {
+        p_ = p.head<2>();
+        information_ = information.topLeftCorner<2, 2>();
+    }
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    Eigen::Vector2d p_;
+    Eigen::Matrix<double, 2, 2> information_;
+};
+
+#endif // CERES_SE2_STRUCTS_H
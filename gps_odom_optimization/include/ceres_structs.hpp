@@ -3,6 +3,14 @@
 #pragma once
 #include "common_types.hpp"
 #include "ceres/ceres.h"
+#include "ceres_analytic_structs.hpp"
+
+/*
+ * Create() returns the hand-derived cost functions of ceres_analytic_structs.hpp when the package is built
+ * with GPS_ODOM_ANALYTIC_JACOBIANS, and the autodiff ones of the functors below otherwise. CreateMutable()
+ * builds the same cost function with a zero information for a CostFunctionPool, and keeps a pointer to the
+ * term (Mutable) whose set() replaces the measurement in place.
+ */
 
 /**
  * @brief: points cost function
@@ -39,16 +47,40 @@ struct PointsErrorTerm {
     static ceres::CostFunction* Create(const Eigen::Vector3d& det,
                                        const Eigen::Vector3d& lm,
                                        const Eigen::Matrix<double, 3, 3>& information) {
+#ifdef GPS_ODOM_ANALYTIC_JACOBIANS
+        return analytic::PointsErrorTerm::Create(det, lm, information);
+#else
         return new ceres::AutoDiffCostFunction<PointsErrorTerm, 3, 3, 4>(new PointsErrorTerm(det, lm, information));
+#endif
+    }
+
+#ifdef GPS_ODOM_ANALYTIC_JACOBIANS
+    typedef analytic::PointsErrorTerm Mutable;
+#else
+    typedef PointsErrorTerm Mutable;
+#endif
+    static ceres::CostFunction* CreateMutable(Mutable*& term) {
+        term = new Mutable(Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero(), Eigen::Matrix<double, 3, 3>::Zero());
+#ifdef GPS_ODOM_ANALYTIC_JACOBIANS
+        return term;
+#else
+        return new ceres::AutoDiffCostFunction<PointsErrorTerm, 3, 3, 4>(term);
+#endif
+    }
+
+    void set(const Eigen::Vector3d& det, const Eigen::Vector3d& lm, const Eigen::Matrix<double, 3, 3>& information) {
+        det_ = det;
+        lm_ = lm;
+        information_ = information;
     }
 
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
     // the matched landmark and detection.
-    const Eigen::Vector3d det_;
-    const Eigen::Vector3d lm_;
+    Eigen::Vector3d det_;
+    Eigen::Vector3d lm_;
     // The square root of the measurement information matrix.
-    const Eigen::Matrix<double, 3, 3> information_;
+    Eigen::Matrix<double, 3, 3> information_;
 };
 
 /**
@@ -89,16 +121,40 @@ struct OdometryErrorTerm {
 
     static ceres::CostFunction* Create(const Eigen::Vector3d tf_p, const Eigen::Quaterniond tf_q,
     		                           const Eigen::Matrix<double, 6, 6>& information) {
+#ifdef GPS_ODOM_ANALYTIC_JACOBIANS
+        return analytic::OdometryErrorTerm::Create(tf_p, tf_q, information);
+#else
         return new ceres::AutoDiffCostFunction<OdometryErrorTerm, 6, 3, 4, 3, 4>(new OdometryErrorTerm(tf_p, tf_q, information));
+#endif
+    }
+
+#ifdef GPS_ODOM_ANALYTIC_JACOBIANS
+    typedef analytic::OdometryErrorTerm Mutable;
+#else
+    typedef OdometryErrorTerm Mutable;
+#endif
+    static ceres::CostFunction* CreateMutable(Mutable*& term) {
+        term = new Mutable(Eigen::Vector3d::Zero(), Eigen::Quaterniond::Identity(), Eigen::Matrix<double, 6, 6>::Zero());
+#ifdef GPS_ODOM_ANALYTIC_JACOBIANS
+        return term;
+#else
+        return new ceres::AutoDiffCostFunction<OdometryErrorTerm, 6, 3, 4, 3, 4>(term);
+#endif
+    }
+
+    void set(const Eigen::Vector3d& tf_p, const Eigen::Quaterniond& tf_q, const Eigen::Matrix<double, 6, 6>& information) {
+        tf_p_ = tf_p;
+        tf_q_ = tf_q;
+        information_ = information;
     }
 
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
     // The measurement for the position of B relative to A in the A frame.
-	const Eigen::Vector3d tf_p_;
-    const Eigen::Quaterniond tf_q_;
+	Eigen::Vector3d tf_p_;
+    Eigen::Quaterniond tf_q_;
     // The square root of the measurement information matrix.
-    const Eigen::Matrix<double, 6, 6> information_;
+    Eigen::Matrix<double, 6, 6> information_;
 };
 
 /**
@@ -136,16 +192,40 @@ struct PriorErrorTerm {
 
     static ceres::CostFunction* Create(const Eigen::Vector3d p, const Eigen::Quaterniond q,
     		                           const Eigen::Matrix<double, 6, 6>& information) {
+#ifdef GPS_ODOM_ANALYTIC_JACOBIANS
+        return analytic::PriorErrorTerm::Create(p, q, information);
+#else
         return new ceres::AutoDiffCostFunction<PriorErrorTerm, 6, 3, 4>(new PriorErrorTerm(p, q, information));
+#endif
+    }
+
+#ifdef GPS_ODOM_ANALYTIC_JACOBIANS
+    typedef analytic::PriorErrorTerm Mutable;
+#else
+    typedef PriorErrorTerm Mutable;
+#endif
+    static ceres::CostFunction* CreateMutable(Mutable*& term) {
+        term = new Mutable(Eigen::Vector3d::Zero(), Eigen::Quaterniond::Identity(), Eigen::Matrix<double, 6, 6>::Zero());
+#ifdef GPS_ODOM_ANALYTIC_JACOBIANS
+        return term;
+#else
+        return new ceres::AutoDiffCostFunction<PriorErrorTerm, 6, 3, 4>(term);
+#endif
+    }
+
+    void set(const Eigen::Vector3d& p, const Eigen::Quaterniond& q, const Eigen::Matrix<double, 6, 6>& information) {
+        p_ = p;
+        q_ = q;
+        information_ = information;
     }
 
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
     // The measurement for the position and orientation.
-	const Eigen::Vector3d p_;
-    const Eigen::Quaterniond q_;
+	Eigen::Vector3d p_;
+    Eigen::Quaterniond q_;
     // The square root of the measurement information matrix.
-    const Eigen::Matrix<double, 6, 6> information_;
+    Eigen::Matrix<double, 6, 6> information_;
 };
 
 
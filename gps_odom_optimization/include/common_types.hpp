@@ -2,7 +2,9 @@
 #define COMMON_TYPES_H
 #pragma once
 
+#include <cmath>
 #include <Eigen/Dense>
+#include "ring_buffer.hpp"
 
 /**
  * @brief PointsConstraint: The Constraint for points associations in the pose graph
@@ -44,17 +46,49 @@ struct PriorConstraint {
 
 	Eigen::Vector3d p;
     Eigen::Quaterniond q;
+#ifdef GPS_ODOM_SE2
+    // (x, y, yaw) parameter block of the planar problem, see setSE2FromPose3d / setPose3dFromSE2
+    Eigen::Vector3d se2;
+#endif
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
     Eigen::Matrix<double, 6, 6> covariance;
     Eigen::Matrix<double, 6, 6> information;
 };
 
+/**
+ * @brief SolveReport: outcome of one map -> odom estimation
+ */
+struct SolveReport {
+	bool converged;  // false if stopped by the iteration or time limit, the estimate is the best iterate
+	bool usable;     // false if the estimate was left as it was
+	int iterations;
+	double time;     // wall-clock seconds
+};
+
 using Pose3dWithCovariance = PriorConstraint;
-using PointsConstraintVector = std::vector<PointsConstraint>;
-using PriorConstraintVector = std::vector<PriorConstraint>;
-using OdometryConstraintsVector = std::vector<OdometryConstraint>;
-using Trajectory = std::vector<Pose3dWithCovariance>;
+using PointsConstraintWindow = RingBuffer<PointsConstraint>;
+using PriorConstraintWindow = RingBuffer<PriorConstraint>;
+using OdometryConstraintsWindow = RingBuffer<OdometryConstraint>;
+using Trajectory = RingBuffer<Pose3dWithCovariance>;
 using Tf = Eigen::Transform<double, 3, Eigen::Isometry, Eigen::DontAlign>;
 
+#ifdef GPS_ODOM_SE2
+/**
+ * @brief Planar parameter block from the 3D pose (the z and the roll and pitch are dropped)
+ */
+inline void setSE2FromPose3d(Pose3dWithCovariance& pose){
+	Eigen::Vector3d axis = pose.q.toRotationMatrix().col(0);
+	pose.se2 = Eigen::Vector3d(pose.p.x(), pose.p.y(), atan2(axis.y(), axis.x()));
+}
+
+/**
+ * @brief 3D pose from the planar parameter block, on the z = 0 plane
+ */
+inline void setPose3dFromSE2(Pose3dWithCovariance& pose){
+	pose.p = Eigen::Vector3d(pose.se2.x(), pose.se2.y(), 0.0);
+	pose.q = Eigen::Quaterniond(Eigen::AngleAxisd(pose.se2.z(), Eigen::Vector3d::UnitZ()));
+}
+#endif
+
 #endif // COMMON_TYPES_H
@@ -0,0 +1,68 @@
+#ifndef COST_FUNCTION_POOL_H
+#define COST_FUNCTION_POOL_H
+#pragma once
+
+#include <vector>
+#include "ceres/ceres.h"
+
+/**
+ * @brief CostFunctionPool: one cost function per slot of a window, allocated once by setCapacity()
+ *
+ * Term is a cost function struct of ceres_structs.hpp or ceres_se2_structs.hpp. A slot keeps its cost
+ * function for the life of the pool and term(i).set() replaces the measurement in place, so a residual
+ * block can stay in a problem while its slot is reused. Until then the information is zero and the
+ * residual and jacobians of the slot are zero. The pool owns the cost functions: the problems they are
+ * added to need cost_function_ownership = DO_NOT_TAKE_OWNERSHIP.
+ */
+template <typename Term>
+class CostFunctionPool {
+public:
+	typedef typename Term::Mutable Mutable;
+
+	CostFunctionPool(void) {
+	}
+	~CostFunctionPool(void) {
+		clear();
+	}
+
+	/**
+	 * @brief Reallocates the pool for the given capacity, the previous cost functions are deleted
+	 */
+	void setCapacity(size_t capacity){
+		clear();
+		cost_functions_.resize(capacity);
+		terms_.resize(capacity);
+		for (size_t i = 0; i < capacity; i++){
+			cost_functions_[i] = Term::CreateMutable(terms_[i]);
+		}
+	}
+
+	ceres::CostFunction* at(size_t index){
+		return cost_functions_.at(index);
+	}
+	Mutable& term(size_t index){
+		return *terms_.at(index);
+	}
+	size_t capacity(void) const {
+		return cost_functions_.size();
+	}
+
+private:
+	// the analytic cost functions are their own term, the autodiff ones own their functor
+	std::vector<ceres::CostFunction*> cost_functions_;
+	std::vector<Mutable*> terms_;
+
+	void clear(void){
+		for (size_t i = 0; i < cost_functions_.size(); i++){
+			delete cost_functions_[i];
+		}
+		cost_functions_.clear();
+		terms_.clear();
+	}
+
+	// the cost functions are owned, not copied
+	CostFunctionPool(const CostFunctionPool&);
+	CostFunctionPool& operator=(const CostFunctionPool&);
+};
+
+#endif // COST_FUNCTION_POOL_H
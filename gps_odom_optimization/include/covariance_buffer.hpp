@@ -0,0 +1,64 @@
+#ifndef COVARIANCE_BUFFER_H
+#define COVARIANCE_BUFFER_H
+#pragma once
+
+#include <atomic>
+#include <Eigen/Core>
+
+/**
+ * @brief CovarianceBuffer: latest map -> odom covariance, double buffered between its recovery and the odometry
+ *
+ * Same scheme as MapToOdomBuffer. The writer is the low-priority covariance thread and the readers never
+ * wait for it: a writer descheduled in the middle of a write only holds the slot the readers are not
+ * pointed at.
+ */
+class CovarianceBuffer {
+public:
+	CovarianceBuffer(void) : version_(0), writing_(0) {
+		for (int slot = 0; slot < 2; slot++){
+			for (int i = 0; i < N_VALUES; i++){
+				values_[slot][i].store(0.0, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void write(const Eigen::Matrix<double, 6, 6>& covariance){
+		unsigned long version = version_.load(std::memory_order_relaxed) + 1;
+		writing_.store(version, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		std::atomic<double>* values = values_[version & 1];
+		for (int i = 0; i < N_VALUES; i++){
+			values[i].store(covariance(i), std::memory_order_relaxed);
+		}
+
+		version_.store(version, std::memory_order_release);
+	}
+
+	/**
+	 * @brief Copies the latest covariance
+	 * @return number of writes so far, 0 while no covariance has been recovered (it is then zero)
+	 */
+	unsigned long read(Eigen::Matrix<double, 6, 6>& covariance) const {
+		unsigned long version;
+		do {
+			version = version_.load(std::memory_order_acquire);
+			const std::atomic<double>* values = values_[version & 1];
+			for (int i = 0; i < N_VALUES; i++){
+				covariance(i) = values[i].load(std::memory_order_relaxed);
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+		} while (writing_.load(std::memory_order_relaxed) > version + 1);
+
+		return version;
+	}
+
+private:
+	static const int N_VALUES = 6 * 6;
+
+	std::atomic<unsigned long> version_; // last published write, its slot is version_ & 1
+	std::atomic<unsigned long> writing_; // write in progress (or last one)
+	std::atomic<double> values_[2][N_VALUES];
+};
+
+#endif // COVARIANCE_BUFFER_H
@@ -0,0 +1,150 @@
+#ifndef COVARIANCE_RECOVERY_H
+#define COVARIANCE_RECOVERY_H
+#pragma once
+
+#include <utility>
+#include <vector>
+#include "ceres_structs.hpp"
+#include "ceres_se2_structs.hpp"
+#include "marginal_prior.hpp"
+
+/**
+ * @brief CovarianceRecovery: covariance of the map -> odom estimate, the only blocks it computes
+ *
+ * The point residuals are rebuilt from a copy of the window at the estimate, so the recovery can run in
+ * another thread than the solver, which keeps its own persistent problem. The node weights the constraints
+ * with the identity, so the inverse hessian is scaled by the a-posteriori variance of the residuals to be
+ * in metres and radians.
+ */
+class CovarianceRecovery {
+public:
+	CovarianceRecovery(double huber_delta) : loss_function_(huber_delta) {
+	}
+
+	/**
+	 * @brief Covariance of map2odom_tf in (x, y, z, roll, pitch, yaw), rotations about the map axes
+	 *
+	 * In the tangent space of the parameter blocks: the rotation is applied on the left of map2odom_tf.
+	 * The SE(2) build leaves z, roll and pitch at 0.
+	 * @return false if the jacobian of the window is degenerate even for the pseudo-inverse, or if the
+	 * window has no more residuals than map -> odom parameters (no residual variance)
+	 */
+	bool compute(const PointsConstraintWindow& constraints_pt, const Pose3dWithCovariance& map2odom_tf,
+				 Eigen::Matrix<double, 6, 6>& covariance){
+		if (constraints_pt.empty()){
+			return false;
+		}
+		Pose3dWithCovariance pose = map2odom_tf;
+#ifdef GPS_ODOM_SE2
+		setSE2FromPose3d(pose);
+#endif
+
+		ceres::Problem::Options problem_options;
+		problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+		problem_options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+		ceres::Problem problem(problem_options);
+		for (size_t j = 0; j < constraints_pt.size(); j++){
+#ifdef GPS_ODOM_SE2
+			problem.AddResidualBlock(PointsErrorTermSE2::Create(constraints_pt[j].detection,
+																constraints_pt[j].landmark,
+																constraints_pt[j].information),
+									 &loss_function_,
+									 pose.se2.data());
+#else
+			problem.AddResidualBlock(PointsErrorTerm::Create(constraints_pt[j].detection,
+															 constraints_pt[j].landmark,
+															 constraints_pt[j].information),
+									 &loss_function_,
+									 pose.p.data(),
+									 pose.q.coeffs().data());
+#endif
+		}
+#ifndef GPS_ODOM_SE2
+		problem.SetParameterization(pose.q.coeffs().data(), &quaternion_local_parameterization_);
+#endif
+
+		double variance;
+		if (!residualVariance(&problem, variance)){
+			return false;
+		}
+
+		ceres::Covariance::Options options;
+		options.algorithm_type = ceres::SPARSE_QR;
+		if (!computeBlocks(options, pose, &problem, covariance)){
+			// a straight drive does not fix the roll about it: SPARSE_QR needs a full rank jacobian, the
+			// dense SVD takes the pseudo-inverse (a few parameters, still cheap)
+			options.algorithm_type = ceres::DENSE_SVD;
+			options.null_space_rank = -1;
+			if (!computeBlocks(options, pose, &problem, covariance)){
+				return false;
+			}
+		}
+		covariance *= variance;
+		return true;
+	}
+
+private:
+	ceres::HuberLoss loss_function_;
+#ifndef GPS_ODOM_SE2
+	ceres::EigenQuaternionParameterization quaternion_local_parameterization_;
+#endif
+
+	/**
+	 * @brief Squared residuals (without the loss) over the redundancy of the window
+	 */
+	bool residualVariance(ceres::Problem* problem, double& variance){
+		int redundancy = problem->NumResiduals() - POSE_TANGENT_SIZE;
+		if (redundancy <= 0){
+			return false;
+		}
+		ceres::Problem::EvaluateOptions options;
+		options.apply_loss_function = false;
+		double cost;
+		if (!problem->Evaluate(options, &cost, NULL, NULL, NULL)){
+			return false;
+		}
+		// the cost is half the squared norm of the residuals
+		variance = 2.0 * cost / redundancy;
+		return true;
+	}
+
+	bool computeBlocks(const ceres::Covariance::Options& options, Pose3dWithCovariance& pose,
+					   ceres::Problem* problem, Eigen::Matrix<double, 6, 6>& covariance){
+		ceres::Covariance estimator(options);
+		std::vector<std::pair<const double*, const double*> > covariance_blocks;
+		covariance.setZero();
+#ifdef GPS_ODOM_SE2
+		covariance_blocks.push_back(std::make_pair(pose.se2.data(), pose.se2.data()));
+		if (!estimator.Compute(covariance_blocks, problem)){
+			return false;
+		}
+		Eigen::Matrix<double, 3, 3, Eigen::RowMajor> covariance_se2;
+		estimator.GetCovarianceBlock(pose.se2.data(), pose.se2.data(), covariance_se2.data());
+		const int rows[3] = {0, 1, 5};
+		for (int i = 0; i < 3; i++){
+			for (int j = 0; j < 3; j++){
+				covariance(rows[i], rows[j]) = covariance_se2(i, j);
+			}
+		}
+#else
+		covariance_blocks.push_back(std::make_pair(pose.p.data(), pose.p.data()));
+		covariance_blocks.push_back(std::make_pair(pose.p.data(), pose.q.coeffs().data()));
+		covariance_blocks.push_back(std::make_pair(pose.q.coeffs().data(), pose.q.coeffs().data()));
+		if (!estimator.Compute(covariance_blocks, problem)){
+			return false;
+		}
+		Eigen::Matrix<double, 3, 3, Eigen::RowMajor> covariance_pp, covariance_pq, covariance_qq;
+		estimator.GetCovarianceBlockInTangentSpace(pose.p.data(), pose.p.data(), covariance_pp.data());
+		estimator.GetCovarianceBlockInTangentSpace(pose.p.data(), pose.q.coeffs().data(), covariance_pq.data());
+		estimator.GetCovarianceBlockInTangentSpace(pose.q.coeffs().data(), pose.q.coeffs().data(), covariance_qq.data());
+		// the tangent dq of EigenQuaternionParameterization is half the rotation vector
+		covariance.topLeftCorner<3, 3>() = covariance_pp;
+		covariance.topRightCorner<3, 3>() = 2.0 * covariance_pq;
+		covariance.bottomLeftCorner<3, 3>() = 2.0 * covariance_pq.transpose();
+		covariance.bottomRightCorner<3, 3>() = 4.0 * covariance_qq;
+#endif
+		return true;
+	}
+};
+
+#endif // COVARIANCE_RECOVERY_H
@@ -30,7 +30,16 @@
 
 #include <eigen_conversions/eigen_msg.h>
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+#include <pthread.h>
+#include <sched.h>
 #include "optimization_process.hpp"
+#include "map_to_odom_buffer.hpp"
+#include "covariance_recovery.hpp"
+#include "covariance_buffer.hpp"
 
 // [publisher subscriber headers]
 #include <tf/transform_listener.h>
@@ -52,8 +61,44 @@ class GpsOdomOptimizationAlgNode : public algorithm_base::IriBaseAlgorithm<GpsOd
   private:
 
 	bool gps_received_;
+	// only used by the solver thread once it is running
 	OptimizationProcessPtr optimization_;
 
+	// the solver thread adds the new point constraints to the window and solves, the odom
+	// callback hands them over and reads the last estimate without waiting for a solve
+	std::thread solver_thread_;
+	std::mutex solver_mutex_;
+	std::condition_variable solver_condition_;
+	PointsConstraintWindow pending_constraints_pt_;
+	PointsConstraintWindow taken_constraints_pt_;
+	bool solver_stop_;
+	MapToOdomBuffer map2odom_buffer_;
+	void solverThread(void);
+
+	// wall-clock bound of a solve (s, 0 for none) and its outcome, under solver_mutex_
+	double solve_time_budget_;
+	SolveReport last_solve_report_;
+	unsigned long n_solves_;
+	unsigned long n_unconverged_solves_;
+
+	// the covariance of map -> odom is recovered in a low-priority thread from a copy of the window
+	// handed over after each solve, a newer solve replaces a request not yet taken. The solver only
+	// try_locks covariance_mutex_: while the low-priority thread holds it the request is skipped, the
+	// next solve hands over a newer window
+	std::thread covariance_thread_;
+	std::mutex covariance_mutex_;
+	std::condition_variable covariance_condition_;
+	PointsConstraintWindow requested_constraints_pt_;
+	PointsConstraintWindow taken_covariance_constraints_pt_;
+	Pose3dWithCovariance requested_map2odom_;
+	bool covariance_requested_;
+	bool covariance_stop_;
+	CovarianceRecovery* covariance_recovery_;
+	// last recovered covariance, (x, y, z, roll, pitch, yaw) of map -> odom, read by the odometry without
+	// waiting on the low-priority thread
+	CovarianceBuffer map2odom_covariance_buffer_;
+	void covarianceThread(void);
+
     // [publisher attributes]
     tf::TransformBroadcaster tf_broadcaster_;
     geometry_msgs::TransformStamped transform_msg_;
@@ -111,6 +156,8 @@ class GpsOdomOptimizationAlgNode : public algorithm_base::IriBaseAlgorithm<GpsOd
     */
     ~GpsOdomOptimizationAlgNode(void);
 
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
   protected:
    /**
     * \brief main node thread
@@ -149,6 +196,10 @@ class GpsOdomOptimizationAlgNode : public algorithm_base::IriBaseAlgorithm<GpsOd
     void addNodeDiagnostics(void);
 
     // [diagnostic functions]
+   /**
+    * \brief last solve time and iterations, warns when solves stop at the time budget
+    */
+    void solverDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
     
     // [test functions]
 };
@@ -0,0 +1,71 @@
+#ifndef MAP_TO_ODOM_BUFFER_H
+#define MAP_TO_ODOM_BUFFER_H
+#pragma once
+
+#include <atomic>
+#include "common_types.hpp"
+
+/**
+ * @brief MapToOdomBuffer: latest map -> odom estimate, double buffered between the solver and the odometry
+ *
+ * One writer (the solver thread) and any number of readers, none of them blocks. A write goes to the
+ * slot the readers are not pointed at and then publishes it, so a reader only retries if the writer
+ * has started a second write into its slot while it was copying, i.e. two solves during one copy of
+ * seven values. The values are relaxed atomics so that the concurrent copy is well defined.
+ */
+class MapToOdomBuffer {
+public:
+	MapToOdomBuffer(void) : version_(0), writing_(0) {
+		for (int slot = 0; slot < 2; slot++){
+			for (int i = 0; i < N_VALUES; i++){
+				values_[slot][i].store(i == N_VALUES - 1 ? 1.0 : 0.0, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void write(const Pose3dWithCovariance& map2odom){
+		unsigned long version = version_.load(std::memory_order_relaxed) + 1;
+		writing_.store(version, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		std::atomic<double>* values = values_[version & 1];
+		for (int i = 0; i < 3; i++){
+			values[i].store(map2odom.p(i), std::memory_order_relaxed);
+		}
+		for (int i = 0; i < 4; i++){
+			values[3 + i].store(map2odom.q.coeffs()(i), std::memory_order_relaxed);
+		}
+
+		version_.store(version, std::memory_order_release);
+	}
+
+	/**
+	 * @brief Copies the latest estimate (translation and rotation)
+	 * @return number of writes so far, 0 if the buffer still holds the identity
+	 */
+	unsigned long read(Eigen::Vector3d& p, Eigen::Quaterniond& q) const {
+		unsigned long version;
+		do {
+			version = version_.load(std::memory_order_acquire);
+			const std::atomic<double>* values = values_[version & 1];
+			for (int i = 0; i < 3; i++){
+				p(i) = values[i].load(std::memory_order_relaxed);
+			}
+			for (int i = 0; i < 4; i++){
+				q.coeffs()(i) = values[3 + i].load(std::memory_order_relaxed);
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+		} while (writing_.load(std::memory_order_relaxed) > version + 1);
+
+		return version;
+	}
+
+private:
+	static const int N_VALUES = 3 + 4; // p, q (x, y, z, w)
+
+	std::atomic<unsigned long> version_; // last published write, its slot is version_ & 1
+	std::atomic<unsigned long> writing_; // write in progress (or last one)
+	std::atomic<double> values_[2][N_VALUES];
+};
+
+#endif // MAP_TO_ODOM_BUFFER_H
@@ -0,0 +1,132 @@
+#ifndef MARGINAL_PRIOR_H
+#define MARGINAL_PRIOR_H
+#pragma once
+#include "common_types.hpp"
+#include "ceres_analytic_structs.hpp"
+
+/*
+ * Tangent space of a pose, the one of its Ceres parameter blocks: (dp, dq) with q = [dq, 1] * q0 as in
+ * EigenQuaternionParameterization, or (dx, dy, dyaw) for the SE(2) build.
+ */
+#ifdef GPS_ODOM_SE2
+static const int POSE_TANGENT_SIZE = 3;
+#else
+static const int POSE_TANGENT_SIZE = 6;
+#endif
+
+/**
+ * @brief MarginalPrior: linear prior left on a pose by the marginalisation of the poses before it
+ *
+ * r = sqrt_information * (pose [-] linearization_point) + residual, the information and gradient of the
+ * Schur complement at the linearisation point.
+ */
+struct MarginalPrior {
+	bool valid;
+	size_t id;
+	Pose3dWithCovariance linearization_point;
+	Eigen::Matrix<double, POSE_TANGENT_SIZE, POSE_TANGENT_SIZE> sqrt_information;
+	Eigen::Matrix<double, POSE_TANGENT_SIZE, 1> residual;
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+#ifdef GPS_ODOM_SE2
+/**
+ * @brief: marginal prior cost function on a (x, y, yaw) pose
+ */
+class MarginalPriorErrorTerm : public ceres::SizedCostFunction<3, 3> {
+public:
+	MarginalPriorErrorTerm(void)
+		: pose0_(Eigen::Vector3d::Zero()), sqrt_information_(Eigen::Matrix3d::Zero()), residual_(Eigen::Vector3d::Zero()) {
+	}
+	MarginalPriorErrorTerm(const MarginalPrior& prior){
+		set(prior);
+	}
+
+	void set(const MarginalPrior& prior){
+		pose0_ = prior.linearization_point.se2;
+		sqrt_information_ = prior.sqrt_information;
+		residual_ = prior.residual;
+	}
+
+	bool Evaluate(double const* const* parameters, double* residuals_ptr, double** jacobians) const override {
+		Eigen::Map<const Eigen::Vector3d> pose(parameters[0]);
+		Eigen::Vector3d delta = pose - pose0_;
+		delta(2) = remainder(delta(2), 2.0 * M_PI);
+
+		Eigen::Map<Eigen::Vector3d> residuals(residuals_ptr);
+		residuals = sqrt_information_ * delta + residual_;
+
+		if (jacobians != NULL && jacobians[0] != NULL){
+			Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>> jacobian(jacobians[0]);
+			jacobian = sqrt_information_;
+		}
+		return true;
+	}
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+	Eigen::Vector3d pose0_;
+	Eigen::Matrix3d sqrt_information_;
+	Eigen::Vector3d residual_;
+};
+#else
+/**
+ * @brief: marginal prior cost function on a position + quaternion pose, dq = vec(q * conj(q0))
+ */
+class MarginalPriorErrorTerm : public ceres::SizedCostFunction<6, 3, 4> {
+public:
+	MarginalPriorErrorTerm(void)
+		: p0_(Eigen::Vector3d::Zero()), q0_inverse_(Eigen::Quaterniond::Identity()),
+		  sqrt_information_(Eigen::Matrix<double, 6, 6>::Zero()), residual_(Eigen::Matrix<double, 6, 1>::Zero()) {
+	}
+	MarginalPriorErrorTerm(const MarginalPrior& prior){
+		set(prior);
+	}
+
+	void set(const MarginalPrior& prior){
+		p0_ = prior.linearization_point.p;
+		q0_inverse_ = prior.linearization_point.q.conjugate();
+		sqrt_information_ = prior.sqrt_information;
+		residual_ = prior.residual;
+	}
+
+	bool Evaluate(double const* const* parameters, double* residuals_ptr, double** jacobians) const override {
+		Eigen::Map<const Eigen::Vector3d> p(parameters[0]);
+		Eigen::Map<const Eigen::Quaterniond> q(parameters[1]);
+
+		// q and -q are the same rotation, the delta is taken on the side of q0
+		Eigen::Quaterniond dq = q * q0_inverse_;
+		double sign = dq.w() < 0.0 ? -1.0 : 1.0;
+		Eigen::Matrix<double, 6, 1> delta;
+		delta.head<3>() = p - p0_;
+		delta.tail<3>() = sign * dq.vec();
+
+		Eigen::Map<Eigen::Matrix<double, 6, 1>> residuals(residuals_ptr);
+		residuals = sqrt_information_ * delta + residual_;
+
+		if (jacobians == NULL){
+			return true;
+		}
+		if (jacobians[0] != NULL){
+			Eigen::Map<Eigen::Matrix<double, 6, 3, Eigen::RowMajor>> jacobian(jacobians[0]);
+			jacobian = sqrt_information_.leftCols<3>();
+		}
+		if (jacobians[1] != NULL){
+			Eigen::Map<Eigen::Matrix<double, 6, 4, Eigen::RowMajor>> jacobian(jacobians[1]);
+			jacobian = sign * sqrt_information_.rightCols<3>() * analytic::rightProduct(q0_inverse_).topRows<3>();
+		}
+		return true;
+	}
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+	Eigen::Vector3d p0_;
+	Eigen::Quaterniond q0_inverse_;
+	Eigen::Matrix<double, 6, 6> sqrt_information_;
+	Eigen::Matrix<double, 6, 1> residual_;
+};
+#endif
+
+#endif // MARGINAL_PRIOR_H
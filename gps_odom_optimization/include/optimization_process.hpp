@@ -1,56 +1,89 @@
+#include <algorithm>
+#include <chrono>
 #include "ceres_structs.hpp"
+#include "ceres_se2_structs.hpp"
+#include "se2_alignment.hpp"
+#include "marginal_prior.hpp"
+#include "cost_function_pool.hpp"
 
 class OptimizationProcess;
 typedef OptimizationProcess* OptimizationProcessPtr;
 
 class OptimizationProcess {
 public:
-	OptimizationProcess(void);
-	~OptimizationProcess() { }
+	/**
+	 * @brief Estimator of map2odom_tf_ used by solveOptimizationProblem()
+	 */
+	enum Estimator {
+		CLOSED_FORM, // SE2Alignment, the Ceres problem if it fails
+		CERES
+	};
+
+	OptimizationProcess(int window_size = 50);
+	~OptimizationProcess() {
+		delete problem_;
+		delete loss_function_;
+		delete quaternion_local_parameterization_;
+	}
 
 	void addMapToOdom (Pose3dWithCovariance map2odom_tf){
 		map2odom_tf_ = map2odom_tf;
+#ifdef GPS_ODOM_SE2
+		setSE2FromPose3d(map2odom_tf_);
+#endif
 	}
-	void addPointConstraint (PointsConstraint constraints_pt){
-		constraints_pt_.push_back(constraints_pt);
-		if (constraints_pt_.size() > window_size_){
-			constraints_pt_.erase(constraints_pt_.begin());
-		}
+	// the windows hold window_size_ elements, a new one overwrites the oldest in place
+	void addPointConstraint (const PointsConstraint& constraints_pt){
+		// so does its measurement in the residual block of the oldest one, problem_ is left as it is
+		const PointsConstraint& constraint = constraints_pt_.push_back(constraints_pt);
+		cost_functions_pt_.term(next_pt_slot_).set(constraint.detection, constraint.landmark, constraint.information);
+		next_pt_slot_ = (next_pt_slot_ + 1) % cost_functions_pt_.capacity();
 	}
-	void addOdometryConstraint (OdometryConstraint constraint_odom){
+	void addOdometryConstraint (const OdometryConstraint& constraint_odom){
 		constraints_odom_.push_back(constraint_odom);
-		if (constraints_odom_.size() > window_size_){
-			constraints_odom_.erase(constraints_odom_.begin());
-		}
 	}
-	void addPriorConstraint (PriorConstraint constraint_prior){
+	void addPriorConstraint (const PriorConstraint& constraint_prior){
 		constraints_prior_.push_back(constraint_prior);
-		if (constraints_prior_.size() > window_size_){
-			constraints_prior_.erase(constraints_prior_.begin());
-		}
 	}
-	void addPose3dToTrajectoryEstimated (Pose3dWithCovariance pose3d_estimated){
-		trajectory_estimated_.push_back(pose3d_estimated);
-		if (trajectory_estimated_.size() > window_size_){
-			trajectory_estimated_.erase(trajectory_estimated_.begin());
+	// the oldest pose of a full window is marginalised into marginal_prior_ before it is overwritten,
+	// a pose is added before its constraints so that the ones of the oldest pose are still in their windows
+	void addPose3dToTrajectoryEstimated (const Pose3dWithCovariance& pose3d_estimated){
+		if (trajectory_estimated_.full()){
+			marginalizeOldestPose();
 		}
+#ifdef GPS_ODOM_SE2
+		setSE2FromPose3d(trajectory_estimated_.push_back(pose3d_estimated));
+#else
+		trajectory_estimated_.push_back(pose3d_estimated);
+#endif
 	}
-	void addPose3dToTrajectoryOdom (Pose3dWithCovariance pose3d_odom){
+	void addPose3dToTrajectoryOdom (const Pose3dWithCovariance& pose3d_odom){
 		trajectory_odom_.push_back(pose3d_odom);
-		if (trajectory_odom_.size() > window_size_){
-			trajectory_odom_.erase(trajectory_odom_.begin());
-		}
 	}
-	Trajectory getTrajectoryEstimated (void){
+	const Trajectory& getTrajectoryEstimated (void){
 		return trajectory_estimated_;
 	}
-	Trajectory getTrajectoryOdom (void){
+	// read by the solver thread to hand a copy of the window to the covariance recovery
+	const PointsConstraintWindow& getPointsConstraints (void){
+		return constraints_pt_;
+	}
+	const Trajectory& getTrajectoryOdom (void){
 		return trajectory_odom_;
 	}
 	Pose3dWithCovariance getMapToOdom (void){
 		return map2odom_tf_;
 	}
+	void setEstimator (Estimator estimator){
+		estimator_ = estimator;
+	}
+	int getWindowSize (void){
+		return window_size_;
+	}
+	double getHuberDelta (void){
+		return huber_delta_;
+	}
 
+	// the cost functions belong to the pools, the problem must not take their ownership
 	void generatePointResiduals (ceres::LossFunction* loss_function,
 			                     ceres::LocalParameterization* quaternion_local_parameterization,
 								 ceres::Problem* problem);
@@ -60,8 +93,8 @@ public:
 	void generatePriorResiduals (ceres::LossFunction* loss_function,
 			                     ceres::LocalParameterization* quaternion_local_parameterization,
 								 ceres::Problem* problem);
-	void solveOptimizationProblem (ceres::Problem* problem);
-	void estimateCovariance (ceres::Problem* problem);
+	SolveReport solveOptimizationProblem (ceres::Problem* problem, double time_budget = 0.0);
+	SolveReport solveOptimizationProblem (double time_budget = 0.0);
 	void propagateState (size_t index);
 
 	bool checkOptimization (void);
@@ -71,20 +104,60 @@ public:
 
 
 private:
-	PointsConstraintVector constraints_pt_;
-	OdometryConstraintsVector constraints_odom_;
-	PriorConstraintVector constraints_prior_;
+	PointsConstraintWindow constraints_pt_;
+	OdometryConstraintsWindow constraints_odom_;
+	PriorConstraintWindow constraints_prior_;
 	Trajectory trajectory_odom_;
 	Trajectory trajectory_estimated_;
 
 	Pose3dWithCovariance map2odom_tf_;
 
 	int window_size_;
+	double huber_delta_;
+
+	Estimator estimator_;
+	SE2Alignment se2_alignment_;
+
+	// long-lived problem with one residual per slot of the points window, map2odom_tf_ is its
+	// parameter block (the previous solution is the initial value of the next solve)
+	ceres::Problem* problem_;
+	ceres::LossFunction* loss_function_;
+	ceres::LocalParameterization* quaternion_local_parameterization_;
+
+	// one cost function per window slot, the measurements are updated in place: no allocation per residual
+#ifdef GPS_ODOM_SE2
+	CostFunctionPool<PointsErrorTermSE2> cost_functions_pt_;
+	CostFunctionPool<OdometryErrorTermSE2> cost_functions_odom_;
+	CostFunctionPool<PriorErrorTermSE2> cost_functions_prior_;
+#else
+	CostFunctionPool<PointsErrorTerm> cost_functions_pt_;
+	CostFunctionPool<OdometryErrorTerm> cost_functions_odom_;
+	CostFunctionPool<PriorErrorTerm> cost_functions_prior_;
+#endif
+	size_t next_pt_slot_; // slot of the next point constraint, the one of the oldest when the window is full
+
+	// prior on the oldest pose of trajectory_estimated_ from the poses already out of the window
+	MarginalPrior marginal_prior_;
+	MarginalPriorErrorTerm marginal_prior_term_;
+	void marginalizeOldestPose (void);
+	void linearizeTerm (const ceres::CostFunction& cost_function, Pose3dWithCovariance* const* poses,
+						const int* states, int n_poses, const ceres::LossFunction* loss_function,
+						Eigen::Matrix<double, 2 * POSE_TANGENT_SIZE, 2 * POSE_TANGENT_SIZE>& hessian,
+						Eigen::Matrix<double, 2 * POSE_TANGENT_SIZE, 1>& gradient);
 };
 
-OptimizationProcess::OptimizationProcess(void) {
+OptimizationProcess::OptimizationProcess(int window_size) {
 
-    window_size_ = 50;
+    window_size_ = window_size;
+	estimator_ = CLOSED_FORM;
+	// the closed form minimises the same robust cost as the Ceres problem
+	huber_delta_ = 0.01;
+	se2_alignment_ = SE2Alignment(huber_delta_);
+	constraints_pt_.setCapacity(window_size_);
+	constraints_odom_.setCapacity(window_size_);
+	constraints_prior_.setCapacity(window_size_);
+	trajectory_odom_.setCapacity(window_size_);
+	trajectory_estimated_.setCapacity(window_size_);
 
     map2odom_tf_.id = 0;
     map2odom_tf_.p.x() = 0.0;
@@ -96,6 +169,38 @@ OptimizationProcess::OptimizationProcess(void) {
 
 	map2odom_tf_.covariance = Eigen::Matrix<double, 6, 6>::Identity();
 
+	// the loss, the parameterization and the cost functions are shared by all the residuals, owned here
+	ceres::Problem::Options problem_options;
+	problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+	problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+	problem_options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+	problem_ = new ceres::Problem(problem_options);
+	loss_function_ = new ceres::HuberLoss(huber_delta_);
+	quaternion_local_parameterization_ = new ceres::EigenQuaternionParameterization;
+#ifdef GPS_ODOM_SE2
+	setSE2FromPose3d(map2odom_tf_);
+	problem_->AddParameterBlock(map2odom_tf_.se2.data(), 3);
+#else
+	problem_->AddParameterBlock(map2odom_tf_.p.data(), 3);
+	problem_->AddParameterBlock(map2odom_tf_.q.coeffs().data(), 4, quaternion_local_parameterization_);
+#endif
+
+	cost_functions_pt_.setCapacity(window_size_);
+	cost_functions_odom_.setCapacity(window_size_);
+	cost_functions_prior_.setCapacity(window_size_);
+	next_pt_slot_ = 0;
+	// a residual block per slot for good, zero until the slot gets a constraint
+	for (int i = 0; i < window_size_; i++){
+#ifdef GPS_ODOM_SE2
+		problem_->AddResidualBlock(cost_functions_pt_.at(i), loss_function_, map2odom_tf_.se2.data());
+#else
+		problem_->AddResidualBlock(cost_functions_pt_.at(i), loss_function_,
+								   map2odom_tf_.p.data(), map2odom_tf_.q.coeffs().data());
+#endif
+	}
+
+	marginal_prior_.valid = false;
+
 	return;
 }
 
@@ -169,23 +274,23 @@ void OptimizationProcess::generatePointResiduals(ceres::LossFunction* loss_funct
 		                                         ceres::LocalParameterization* quaternion_local_parameterization,
 												 ceres::Problem* problem)
 {
+#ifdef GPS_ODOM_SE2
+	(void)quaternion_local_parameterization; // the SE(2) poses have none
+#endif
 	//// Generate residuals
+	// the slots are filled in order: the first size() ones hold the window, with their measurements set
 	for (int j = 0; j < constraints_pt_.size(); j++){
-
-		size_t index = j;
-
-		//problem->AddParameterBlock(trajectory_estimated_.at(index).p.data(), 3); // for cov estimation
-		//problem->AddParameterBlock(trajectory_estimated_.at(index).q.coeffs().data(), 4);
-
-		ceres::CostFunction* cost_function_pt = PointsErrorTerm::Create(constraints_pt_.at(j).detection,
-																		constraints_pt_.at(j).landmark,
-																		constraints_pt_.at(j).information);
-
-		problem->AddResidualBlock(cost_function_pt,
+#ifdef GPS_ODOM_SE2
+		problem->AddResidualBlock(cost_functions_pt_.at(j),
+								  loss_function,
+								  map2odom_tf_.se2.data());
+#else
+		problem->AddResidualBlock(cost_functions_pt_.at(j),
 								  loss_function,
 								  map2odom_tf_.p.data(),
 								  map2odom_tf_.q.coeffs().data());
 		problem->SetParameterization(map2odom_tf_.q.coeffs().data(), quaternion_local_parameterization);
+#endif
 	}
 	return;
 }
@@ -194,13 +299,22 @@ void OptimizationProcess::generateOdomResiduals(ceres::LossFunction* loss_functi
 		                                        ceres::LocalParameterization* quaternion_local_parameterization,
 												ceres::Problem* problem)
 {
+#ifdef GPS_ODOM_SE2
+	(void)quaternion_local_parameterization; // the SE(2) poses have none
+#endif
 	//// Generate residuals
 	for (int j = 1; j < constraints_odom_.size(); j++){
 
-		ceres::CostFunction* cost_function_odom = OdometryErrorTerm::Create(constraints_odom_.at(j).tf_p,
-																			constraints_odom_.at(j).tf_q,
-																			constraints_odom_.at(j).information);
-		problem->AddResidualBlock(cost_function_odom,
+		cost_functions_odom_.term(j).set(constraints_odom_.at(j).tf_p,
+										 constraints_odom_.at(j).tf_q,
+										 constraints_odom_.at(j).information);
+#ifdef GPS_ODOM_SE2
+		problem->AddResidualBlock(cost_functions_odom_.at(j),
+								  loss_function,
+								  trajectory_estimated_.at(j-1).se2.data(),
+								  trajectory_estimated_.at(j).se2.data());
+#else
+		problem->AddResidualBlock(cost_functions_odom_.at(j),
 								  loss_function,
 								  trajectory_estimated_.at(j-1).p.data(),
 								  trajectory_estimated_.at(j-1).q.coeffs().data(),
@@ -209,6 +323,7 @@ void OptimizationProcess::generateOdomResiduals(ceres::LossFunction* loss_functi
 
 		problem->SetParameterization(trajectory_estimated_.at(j-1).q.coeffs().data(), quaternion_local_parameterization);
 		problem->SetParameterization(trajectory_estimated_.at(j).q.coeffs().data(), quaternion_local_parameterization);
+#endif
 	}
 	return;
 }
@@ -217,79 +332,266 @@ void OptimizationProcess::generatePriorResiduals(ceres::LossFunction* loss_funct
 		                                         ceres::LocalParameterization* quaternion_local_parameterization,
 												 ceres::Problem* problem)
 {
+#ifdef GPS_ODOM_SE2
+	(void)quaternion_local_parameterization; // the SE(2) poses have none
+#endif
 	//// Generate residuals
 	for (int j = 0; j < constraints_prior_.size(); j++){
-		ceres::CostFunction* cost_function_prior = PriorErrorTerm::Create(constraints_prior_.at(j).p,
-																		  constraints_prior_.at(j).q,
-																		  constraints_prior_.at(j).information);
-		problem->AddResidualBlock(cost_function_prior,
+		cost_functions_prior_.term(j).set(constraints_prior_.at(j).p,
+										  constraints_prior_.at(j).q,
+										  constraints_prior_.at(j).information);
+#ifdef GPS_ODOM_SE2
+		problem->AddResidualBlock(cost_functions_prior_.at(j),
+								  loss_function,
+								  trajectory_estimated_.at(j).se2.data());
+#else
+		problem->AddResidualBlock(cost_functions_prior_.at(j),
 								  loss_function,
 								  trajectory_estimated_.at(j).p.data(),
 								  trajectory_estimated_.at(j).q.coeffs().data());
 		problem->SetParameterization(trajectory_estimated_.at(j).q.coeffs().data(), quaternion_local_parameterization);
+#endif
 	}
-	return;
-}
 
-void OptimizationProcess::solveOptimizationProblem(ceres::Problem* problem)
-{
-    //CHECK(problem != NULL);
-    ceres::Solver::Options options;
-    options.max_num_iterations = 100;
-    options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
-    ceres::Solver::Summary summary;
-    //std::cout << "Pre-solve" << std::endl;
-    ceres::Solve(options, problem, &summary);
-    //std::cout << "Post-solve" << std::endl;
-    //std::cout << summary.FullReport() << '\n';
+	// information of the poses that already left the window
+	if (marginal_prior_.valid && trajectory_estimated_.size() > 0 && trajectory_estimated_.front().id == marginal_prior_.id){
+		marginal_prior_term_.set(marginal_prior_);
+#ifdef GPS_ODOM_SE2
+		problem->AddResidualBlock(&marginal_prior_term_,
+								  NULL,
+								  trajectory_estimated_.front().se2.data());
+#else
+		problem->AddResidualBlock(&marginal_prior_term_,
+								  NULL,
+								  trajectory_estimated_.front().p.data(),
+								  trajectory_estimated_.front().q.coeffs().data());
+		problem->SetParameterization(trajectory_estimated_.front().q.coeffs().data(), quaternion_local_parameterization);
+#endif
+	}
 	return;
 }
 
-
 /*
-
-
-
-void OptimizationProcess::estimateCovariance(ceres::Problem* problem)
+ * Schur complement of the oldest pose of the window onto the next one. The prior and odometry constraints
+ * of the oldest pose still in their windows (matched by id) and its own marginal prior are linearised at
+ * the current estimates, in the tangent space of the parameter blocks and with the first order weight of
+ * the robust loss. Eliminating the oldest pose leaves a dense linear prior on the next one: its constraints
+ * keep counting after they leave the window. Without an odometry constraint between the two poses nothing
+ * is carried over.
+ */
+void OptimizationProcess::marginalizeOldestPose(void)
 {
-	ceres::Covariance::Options options;
-	ceres::Covariance covariance(options);
-
-	size_t index = trajectory_estimated_.size() -1;
+	const int N = POSE_TANGENT_SIZE;
+	if (trajectory_estimated_.size() < 2){
+		marginal_prior_.valid = false;
+		return;
+	}
 
-	std::vector<std::pair<const double*, const double*> > covariance_blocks;
-	covariance_blocks.push_back(std::make_pair(trajectory_estimated_.at(index).p.data(), trajectory_estimated_.at(index).p.data()));
-	covariance_blocks.push_back(std::make_pair(trajectory_estimated_.at(index).q.coeffs().data(), trajectory_estimated_.at(index).q.coeffs().data()));
+	Pose3dWithCovariance* poses[2] = {&trajectory_estimated_[0], &trajectory_estimated_[1]};
+	const int oldest[1] = {0};
+	const int both[2] = {0, 1};
+	Eigen::Matrix<double, 2 * N, 2 * N> hessian = Eigen::Matrix<double, 2 * N, 2 * N>::Zero();
+	Eigen::Matrix<double, 2 * N, 1> gradient = Eigen::Matrix<double, 2 * N, 1>::Zero();
+
+	bool linked = false;
+	for (size_t j = 0; j < constraints_odom_.size(); j++){
+		const OdometryConstraint& constraint = constraints_odom_[j];
+		if (constraint.id_begin != poses[0]->id || constraint.id_end != poses[1]->id){
+			continue;
+		}
+		cost_functions_odom_.term(j).set(constraint.tf_p, constraint.tf_q, constraint.information);
+		linearizeTerm(*cost_functions_odom_.at(j), poses, both, 2, loss_function_, hessian, gradient);
+		linked = true;
+	}
+	if (!linked){
+		marginal_prior_.valid = false;
+		return;
+	}
 
-	CHECK(covariance.Compute(covariance_blocks, problem));
+	for (size_t j = 0; j < constraints_prior_.size(); j++){
+		const PriorConstraint& constraint = constraints_prior_[j];
+		if (constraint.id != poses[0]->id){
+			continue;
+		}
+		cost_functions_prior_.term(j).set(constraint.p, constraint.q, constraint.information);
+		linearizeTerm(*cost_functions_prior_.at(j), poses, oldest, 1, loss_function_, hessian, gradient);
+	}
+	if (marginal_prior_.valid && marginal_prior_.id == poses[0]->id){
+		marginal_prior_term_.set(marginal_prior_);
+		linearizeTerm(marginal_prior_term_, poses, oldest, 1, NULL, hessian, gradient);
+	}
 
-	double covariance_pp[3 * 3];
-	double covariance_qq[4 * 4];
-	covariance.GetCovarianceBlock(trajectory_estimated_.at(index).p.data(), trajectory_estimated_.at(index).p.data(), covariance_pp);
-	covariance.GetCovarianceBlock(trajectory_estimated_.at(index).q.coeffs().data(), trajectory_estimated_.at(index).q.coeffs().data(), covariance_qq);
+	// eliminate the oldest pose, pseudo-inverse: its prior does not constrain the orientation
+	Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, N, N>> oldest_hessian(hessian.topLeftCorner<N, N>());
+	Eigen::Matrix<double, N, 1> eigenvalues = oldest_hessian.eigenvalues();
+	double threshold = 1e-9 * std::max(eigenvalues.maxCoeff(), 1e-300);
+	Eigen::Matrix<double, N, 1> inverse_eigenvalues;
+	for (int i = 0; i < N; i++){
+		inverse_eigenvalues(i) = eigenvalues(i) > threshold ? 1.0 / eigenvalues(i) : 0.0;
+	}
+	Eigen::Matrix<double, N, N> oldest_inverse = oldest_hessian.eigenvectors() * inverse_eigenvalues.asDiagonal()
+			* oldest_hessian.eigenvectors().transpose();
+
+	Eigen::Matrix<double, N, N> cross = hessian.bottomLeftCorner<N, N>() * oldest_inverse;
+	Eigen::Matrix<double, N, N> schur = hessian.bottomRightCorner<N, N>() - cross * hessian.topRightCorner<N, N>();
+	Eigen::Matrix<double, N, 1> schur_gradient = gradient.tail<N>() - cross * gradient.head<N>();
+
+	// schur = S^T * S and S^T * e = schur_gradient, the same quadratic as a residual S * dx + e
+	Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, N, N>> factor(0.5 * (schur + schur.transpose()));
+	eigenvalues = factor.eigenvalues();
+	threshold = 1e-9 * std::max(eigenvalues.maxCoeff(), 1e-300);
+	for (int i = 0; i < N; i++){
+		if (eigenvalues(i) > threshold){
+			double sqrt_eigenvalue = sqrt(eigenvalues(i));
+			marginal_prior_.sqrt_information.row(i) = sqrt_eigenvalue * factor.eigenvectors().col(i).transpose();
+			marginal_prior_.residual(i) = factor.eigenvectors().col(i).dot(schur_gradient) / sqrt_eigenvalue;
+		}else{
+			marginal_prior_.sqrt_information.row(i).setZero();
+			marginal_prior_.residual(i) = 0.0;
+		}
+	}
+	marginal_prior_.valid = true;
+	marginal_prior_.id = poses[1]->id;
+	marginal_prior_.linearization_point = *poses[1];
+	return;
+}
 
-	trajectory_estimated_.at(index).covariance(0, 0) = covariance_pp[0];
-	trajectory_estimated_.at(index).covariance(0, 1) = covariance_pp[1];
-	trajectory_estimated_.at(index).covariance(1, 0) = covariance_pp[3];
-	trajectory_estimated_.at(index).covariance(1, 1) = covariance_pp[4];
+/*
+ * Adds J^T J and J^T r of a cost function to the system of the two oldest poses, J in their tangent spaces.
+ */
+void OptimizationProcess::linearizeTerm(const ceres::CostFunction& cost_function, Pose3dWithCovariance* const* poses,
+										const int* states, int n_poses, const ceres::LossFunction* loss_function,
+										Eigen::Matrix<double, 2 * POSE_TANGENT_SIZE, 2 * POSE_TANGENT_SIZE>& hessian,
+										Eigen::Matrix<double, 2 * POSE_TANGENT_SIZE, 1>& gradient)
+{
+	const int MAX_RESIDUALS = 6;
+	const int MAX_BLOCKS = 4;
+	typedef Eigen::Matrix<double, MAX_RESIDUALS, 3> ResidualsBy3;
+#ifndef GPS_ODOM_SE2
+	typedef Eigen::Matrix<double, MAX_RESIDUALS, 4> ResidualsBy4;
+#endif
+
+	int n_residuals = cost_function.num_residuals();
+	const double* parameters[MAX_BLOCKS];
+	double jacobian_blocks[MAX_BLOCKS][MAX_RESIDUALS * 4];
+	double* jacobians[MAX_BLOCKS];
+	double residuals[MAX_RESIDUALS];
+	int n_blocks = 0;
+	for (int k = 0; k < n_poses; k++){
+#ifdef GPS_ODOM_SE2
+		parameters[n_blocks++] = poses[k]->se2.data();
+#else
+		parameters[n_blocks++] = poses[k]->p.data();
+		parameters[n_blocks++] = poses[k]->q.coeffs().data();
+#endif
+	}
+	for (int i = 0; i < n_blocks; i++){
+		jacobians[i] = jacobian_blocks[i];
+	}
+	if (!cost_function.Evaluate(parameters, residuals, jacobians)){
+		return;
+	}
 
-    // yaw (z-axis rotation)
-    double siny_cosp = 2 * (trajectory_estimated_.at(index).q.w() * trajectory_estimated_.at(index).q.z() + trajectory_estimated_.at(index).q.x() * trajectory_estimated_.at(index).q.y());
-    double cosy_cosp = 1 - 2 * (trajectory_estimated_.at(index).q.y() * trajectory_estimated_.at(index).q.y() + trajectory_estimated_.at(index).q.z() * trajectory_estimated_.at(index).q.z());
-    double yaw = std::atan2(siny_cosp, cosy_cosp);
+	// zero padded to MAX_RESIDUALS rows, the row-major blocks have n_residuals rows
+	Eigen::Matrix<double, MAX_RESIDUALS, 2 * POSE_TANGENT_SIZE> jacobian =
+			Eigen::Matrix<double, MAX_RESIDUALS, 2 * POSE_TANGENT_SIZE>::Zero();
+	for (int k = 0; k < n_poses; k++){
+		int column = states[k] * POSE_TANGENT_SIZE;
+#ifdef GPS_ODOM_SE2
+		ResidualsBy3 jacobian_se2 = ResidualsBy3::Zero();
+		jacobian_se2.topRows(n_residuals) =
+				Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 3, Eigen::RowMajor>>(jacobian_blocks[k], n_residuals, 3);
+		jacobian.block<MAX_RESIDUALS, 3>(0, column) = jacobian_se2;
+#else
+		ResidualsBy3 jacobian_p = ResidualsBy3::Zero();
+		ResidualsBy4 jacobian_q = ResidualsBy4::Zero();
+		jacobian_p.topRows(n_residuals) =
+				Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 3, Eigen::RowMajor>>(jacobian_blocks[2 * k], n_residuals, 3);
+		jacobian_q.topRows(n_residuals) =
+				Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 4, Eigen::RowMajor>>(jacobian_blocks[2 * k + 1], n_residuals, 4);
+		Eigen::Matrix<double, 4, 3, Eigen::RowMajor> plus_jacobian;
+		quaternion_local_parameterization_->ComputeJacobian(poses[k]->q.coeffs().data(), plus_jacobian.data());
+		jacobian.block<MAX_RESIDUALS, 3>(0, column) = jacobian_p;
+		jacobian.block<MAX_RESIDUALS, 3>(0, column + 3) = jacobian_q * plus_jacobian;
+#endif
+	}
 
-    double x = covariance_qq[0];
-    double y = covariance_qq[5];
-    double z = covariance_qq[10];
-    double w = covariance_qq[15];
+	Eigen::Matrix<double, MAX_RESIDUALS, 1> residual = Eigen::Matrix<double, MAX_RESIDUALS, 1>::Zero();
+	residual.head(n_residuals) = Eigen::Map<Eigen::VectorXd>(residuals, n_residuals);
+	if (loss_function != NULL){
+		double rho[3];
+		loss_function->Evaluate(residual.squaredNorm(), rho);
+		double weight = sqrt(rho[1]);
+		residual *= weight;
+		jacobian *= weight;
+	}
+	hessian += jacobian.transpose() * jacobian;
+	gradient += jacobian.transpose() * residual;
+	return;
+}
 
-    // yaw (z-axis rotation)
-    siny_cosp = 2 * (w * z + x * y);
-    cosy_cosp = 1 - 2 * (y * y + z * z);
-    double yaw_cov = std::atan2(siny_cosp, cosy_cosp);
+/*
+ * Solves map2odom_tf_ with the persistent problem. time_budget is the wall-clock bound in seconds of
+ * the call (0 for none): when it runs out the best iterate so far is kept and the report is not
+ * converged.
+ */
+SolveReport OptimizationProcess::solveOptimizationProblem(double time_budget)
+{
+	// the residuals stay in problem_ with the closed form, the Ceres fallback is always ready
+	if (estimator_ == CLOSED_FORM){
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool aligned = se2_alignment_.align(constraints_pt_, map2odom_tf_);
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (aligned){
+#ifdef GPS_ODOM_SE2
+			setSE2FromPose3d(map2odom_tf_);
+#endif
+			SolveReport report;
+			report.converged = se2_alignment_.hasConverged();
+			report.usable = true;
+			report.iterations = se2_alignment_.getIterations();
+			report.time = elapsed;
+			return report;
+		}
+		if (time_budget > 0.0){
+			time_budget = std::max(time_budget - elapsed, 1e-6);
+		}
+	}
+	return solveOptimizationProblem(problem_, time_budget);
+}
 
-    trajectory_estimated_.at(index).covariance(5, 5) = yaw_cov * 10;
+SolveReport OptimizationProcess::solveOptimizationProblem(ceres::Problem* problem, double time_budget)
+{
+    //CHECK(problem != NULL);
+    ceres::Solver::Options options;
+    options.max_num_iterations = 100;
+    // a few map -> odom parameters: dense QR has no sparse analysis to amortise, the poses of the
+    // trajectory are better with the sparse normal equations
+    options.linear_solver_type = problem->NumParameters() <= 64 ? ceres::DENSE_QR : ceres::SPARSE_NORMAL_CHOLESKY;
+    if (time_budget > 0.0){
+        // checked between iterations, the parameters are left at the best accepted iterate
+        options.max_solver_time_in_seconds = time_budget;
+    }
+    ceres::Solver::Summary summary;
+    //std::cout << "Pre-solve" << std::endl;
+    ceres::Solve(options, problem, &summary);
+    //std::cout << "Post-solve" << std::endl;
+    //std::cout << summary.FullReport() << '\n';
 
-	return;
+#ifdef GPS_ODOM_SE2
+    // the 3D poses follow the planar parameter blocks
+    setPose3dFromSE2(map2odom_tf_);
+    for (size_t i = 0; i < trajectory_estimated_.size(); i++){
+        setPose3dFromSE2(trajectory_estimated_[i]);
+    }
+#endif
+
+    SolveReport report;
+    report.converged = summary.termination_type == ceres::CONVERGENCE;
+    report.usable = summary.IsSolutionUsable();
+    report.iterations = summary.num_successful_steps + summary.num_unsuccessful_steps;
+    report.time = summary.total_time_in_seconds;
+	return report;
 }
-*/
+
+
@@ -0,0 +1,124 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+#pragma once
+
+#include <stdexcept>
+#include <vector>
+#include <Eigen/StdVector>
+
+/**
+ * @brief RingBuffer: fixed-capacity sliding window with stable element addresses
+ *
+ * The storage is allocated once by setCapacity() and never moves: an element
+ * keeps its address while it is in the window, so Ceres parameter blocks can
+ * point into it. push_back() on a full buffer overwrites the oldest slot in
+ * O(1) (the caller must be done with front() before, e.g. removing its
+ * residual blocks). Index 0 is the oldest element, size() - 1 the newest.
+ */
+template <typename T>
+class RingBuffer {
+public:
+	RingBuffer(size_t capacity = 0) : head_(0), size_(0) {
+		storage_.resize(capacity);
+	}
+
+	/**
+	 * @brief Reallocates the storage for the given capacity, the buffer is emptied
+	 */
+	void setCapacity(size_t capacity){
+		storage_.clear();
+		storage_.resize(capacity);
+		head_ = 0;
+		size_ = 0;
+	}
+
+	/**
+	 * @brief Appends an element, overwriting the oldest one when the buffer is full
+	 * @return the stored element
+	 */
+	T& push_back(const T& element){
+		if (storage_.empty()){
+			throw std::length_error("RingBuffer::push_back: zero capacity");
+		}
+		size_t slot;
+		if (size_ < storage_.size()){
+			slot = physicalIndex(size_);
+			size_++;
+		}else{
+			slot = head_;
+			head_ = physicalIndex(1);
+		}
+		storage_[slot] = element;
+		return storage_[slot];
+	}
+
+	void pop_front(void){
+		if (size_ > 0){
+			head_ = physicalIndex(1);
+			size_--;
+		}
+	}
+
+	void clear(void){
+		head_ = 0;
+		size_ = 0;
+	}
+
+	T& operator[](size_t index){
+		return storage_[physicalIndex(index)];
+	}
+	const T& operator[](size_t index) const {
+		return storage_[physicalIndex(index)];
+	}
+
+	T& at(size_t index){
+		if (index >= size_){
+			throw std::out_of_range("RingBuffer::at");
+		}
+		return storage_[physicalIndex(index)];
+	}
+	const T& at(size_t index) const {
+		if (index >= size_){
+			throw std::out_of_range("RingBuffer::at");
+		}
+		return storage_[physicalIndex(index)];
+	}
+
+	T& front(void){
+		return storage_[head_];
+	}
+	const T& front(void) const {
+		return storage_[head_];
+	}
+	T& back(void){
+		return storage_[physicalIndex(size_ - 1)];
+	}
+	const T& back(void) const {
+		return storage_[physicalIndex(size_ - 1)];
+	}
+
+	size_t size(void) const {
+		return size_;
+	}
+	size_t capacity(void) const {
+		return storage_.size();
+	}
+	bool empty(void) const {
+		return size_ == 0;
+	}
+	bool full(void) const {
+		return size_ == storage_.size();
+	}
+
+private:
+	size_t physicalIndex(size_t index) const {
+		size_t slot = head_ + index;
+		return slot < storage_.size() ? slot : slot - storage_.size();
+	}
+
+	std::vector<T, Eigen::aligned_allocator<T>> storage_;
+	size_t head_;
+	size_t size_;
+};
+
+#endif // RING_BUFFER_H
@@ -0,0 +1,134 @@
+#ifndef SE2_ALIGNMENT_H
+#define SE2_ALIGNMENT_H
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include "common_types.hpp"
+
+/**
+ * @brief SE2Alignment: closed-form map -> odom estimate from the point constraints
+ *
+ * Minimises the same cost as the Ceres problem built from PointsErrorTerm, sum of
+ * huber(|I * (R * detection + t - landmark)|^2), for a planar R, t: every iteration solves the
+ * weighted 2D registration in closed form (weighted centroids and the atan2 of the cross
+ * covariance, Horn/Umeyama) and updates the weights from the residuals (IRLS), starting from the
+ * current estimate. The information matrices enter as the isotropic weight (I^T I)(0,0) +
+ * (I^T I)(1,1) over 2, which is exact for the isotropic ones the node builds.
+ */
+class SE2Alignment {
+public:
+	SE2Alignment(double huber_delta = 0.01, int max_iterations = 50, double tolerance = 1e-6)
+		: huber_delta_(huber_delta), max_iterations_(max_iterations), tolerance_(tolerance), iterations_(0), converged_(false) {
+	}
+
+	/**
+	 * @brief Refines map2odom (translation and yaw) with the constraints of the window
+	 * @return false, and map2odom untouched, when the constraints do not fix the rotation
+	 */
+	bool align(const PointsConstraintWindow& constraints, Pose3dWithCovariance& map2odom){
+		iterations_ = 0;
+		converged_ = false;
+		if (constraints.size() < 2){
+			return false;
+		}
+
+		Eigen::Vector3d axis = map2odom.q.toRotationMatrix().col(0);
+		double yaw = atan2(axis.y(), axis.x());
+		double x = map2odom.p.x();
+		double y = map2odom.p.y();
+
+		for (iterations_ = 1; iterations_ <= max_iterations_; iterations_++){
+			double c = cos(yaw);
+			double s = sin(yaw);
+
+			// weighted centroids
+			double weight_sum = 0.0;
+			Eigen::Vector2d det_mean = Eigen::Vector2d::Zero();
+			Eigen::Vector2d lm_mean = Eigen::Vector2d::Zero();
+			for (size_t i = 0; i < constraints.size(); i++){
+				const PointsConstraint& constraint = constraints[i];
+				double weight = constraintWeight(constraint, c, s, x, y);
+				weight_sum += weight;
+				det_mean += weight * constraint.detection.head<2>();
+				lm_mean += weight * constraint.landmark.head<2>();
+			}
+			if (!(weight_sum > 0.0)){
+				return false;
+			}
+			det_mean /= weight_sum;
+			lm_mean /= weight_sum;
+
+			// rotation from the weighted cross covariance of the centred points
+			double dot = 0.0;
+			double cross = 0.0;
+			for (size_t i = 0; i < constraints.size(); i++){
+				const PointsConstraint& constraint = constraints[i];
+				double weight = constraintWeight(constraint, c, s, x, y);
+				Eigen::Vector2d det = constraint.detection.head<2>() - det_mean;
+				Eigen::Vector2d lm = constraint.landmark.head<2>() - lm_mean;
+				dot += weight * det.dot(lm);
+				cross += weight * (det.x() * lm.y() - det.y() * lm.x());
+			}
+			if (dot * dot + cross * cross < 1e-18 * weight_sum * weight_sum){
+				return false;
+			}
+
+			double new_yaw = atan2(cross, dot);
+			c = cos(new_yaw);
+			s = sin(new_yaw);
+			double new_x = lm_mean.x() - (c * det_mean.x() - s * det_mean.y());
+			double new_y = lm_mean.y() - (s * det_mean.x() + c * det_mean.y());
+
+			double yaw_change = fabs(remainder(new_yaw - yaw, 2.0 * M_PI));
+			double translation_change = hypot(new_x - x, new_y - y);
+			yaw = new_yaw;
+			x = new_x;
+			y = new_y;
+			if (yaw_change < tolerance_ && translation_change < tolerance_){
+				converged_ = true;
+				break;
+			}
+		}
+		iterations_ = std::min(iterations_, max_iterations_);
+
+		map2odom.p = Eigen::Vector3d(x, y, 0.0);
+		map2odom.q = Eigen::Quaterniond(Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()));
+		return true;
+	}
+
+	/**
+	 * @brief Number of IRLS iterations of the last align()
+	 */
+	int getIterations(void) const {
+		return iterations_;
+	}
+	/**
+	 * @brief Whether the last align() met the tolerance within max_iterations
+	 */
+	bool hasConverged(void) const {
+		return converged_;
+	}
+
+private:
+	/**
+	 * @brief IRLS weight of a constraint at the pose (c, s, x, y): information weight times huber'
+	 */
+	double constraintWeight(const PointsConstraint& constraint, double c, double s, double x, double y) const {
+		const Eigen::Vector3d& det = constraint.detection;
+		Eigen::Vector3d error(c * det.x() - s * det.y() + x - constraint.landmark.x(),
+		                      s * det.x() + c * det.y() + y - constraint.landmark.y(),
+		                      det.z() - constraint.landmark.z());
+		double norm = (constraint.information * error).norm();
+		double weight = 0.5 * (constraint.information.col(0).squaredNorm() + constraint.information.col(1).squaredNorm());
+		return norm > huber_delta_ ? weight * huber_delta_ / norm : weight;
+	}
+
+	double huber_delta_;
+	int max_iterations_;
+	double tolerance_;
+	int iterations_;
+	bool converged_;
+};
+
+#endif // SE2_ALIGNMENT_H
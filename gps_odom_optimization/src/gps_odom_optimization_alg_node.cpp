@@ -5,7 +5,15 @@ GpsOdomOptimizationAlgNode::GpsOdomOptimizationAlgNode(void) :
 {
   //init class attributes if necessary
   this->gps_received_ = false;
-  this->optimization_ = new OptimizationProcess();
+  // the odometry constraints link two consecutive poses, a window needs at least two
+  int window_size = 50;
+  this->private_node_handle_.getParam("window_size", window_size);
+  if (window_size < 2)
+  {
+	ROS_WARN("GpsOdomOptimizationAlgNode::GpsOdomOptimizationAlgNode: param 'window_size' is %d, it must be at least 2, using 50", window_size);
+	window_size = 50;
+  }
+  this->optimization_ = new OptimizationProcess(window_size);
   if(!this->private_node_handle_.getParam("rate", this->config_.rate))
   {
 	ROS_WARN("GpsOdomOptimizationAlgNode::GpsOdomOptimizationAlgNode: param 'rate' not found");
@@ -13,6 +21,42 @@ GpsOdomOptimizationAlgNode::GpsOdomOptimizationAlgNode(void) :
   else
 	this->setRate(this->config_.rate);
 
+  std::string estimator = "closed_form";
+  this->private_node_handle_.getParam("estimator", estimator);
+  if (estimator == "ceres")
+	this->optimization_->setEstimator(OptimizationProcess::CERES);
+  else if (estimator != "closed_form")
+	ROS_WARN("GpsOdomOptimizationAlgNode::GpsOdomOptimizationAlgNode: unknown estimator '%s', using closed_form", estimator.c_str());
+
+  this->solve_time_budget_ = 0.01;
+  this->private_node_handle_.getParam("solve_time_budget", this->solve_time_budget_);
+  this->last_solve_report_.converged = true;
+  this->last_solve_report_.usable = true;
+  this->last_solve_report_.iterations = 0;
+  this->last_solve_report_.time = 0.0;
+  this->n_solves_ = 0;
+  this->n_unconverged_solves_ = 0;
+
+  // a window of fixes can wait for the solver, older ones would leave the window anyway
+  this->pending_constraints_pt_.setCapacity(this->optimization_->getWindowSize());
+  this->taken_constraints_pt_.setCapacity(this->optimization_->getWindowSize());
+  this->solver_stop_ = false;
+  this->map2odom_buffer_.write(this->optimization_->getMapToOdom());
+
+  this->requested_constraints_pt_.setCapacity(this->optimization_->getWindowSize());
+  this->taken_covariance_constraints_pt_.setCapacity(this->optimization_->getWindowSize());
+  this->covariance_requested_ = false;
+  this->covariance_stop_ = false;
+  this->covariance_recovery_ = new CovarianceRecovery(this->optimization_->getHuberDelta());
+  this->covariance_thread_ = std::thread(&GpsOdomOptimizationAlgNode::covarianceThread, this);
+  // only runs when the solver and the callbacks leave the cpu idle
+  sched_param covariance_priority;
+  covariance_priority.sched_priority = 0;
+  if (pthread_setschedparam(this->covariance_thread_.native_handle(), SCHED_IDLE, &covariance_priority) != 0)
+	ROS_WARN("GpsOdomOptimizationAlgNode::GpsOdomOptimizationAlgNode: covariance thread left at the default priority");
+
+  this->solver_thread_ = std::thread(&GpsOdomOptimizationAlgNode::solverThread, this);
+
   // [init publishers]
   this->localization_publisher_ = this->public_node_handle_.advertise<nav_msgs::Odometry>("localization", 1);
   
@@ -36,6 +80,20 @@ GpsOdomOptimizationAlgNode::GpsOdomOptimizationAlgNode(void) :
 GpsOdomOptimizationAlgNode::~GpsOdomOptimizationAlgNode(void)
 {
   // [free dynamic memory]
+  {
+    std::lock_guard<std::mutex> lock(this->solver_mutex_);
+    this->solver_stop_ = true;
+  }
+  this->solver_condition_.notify_one();
+  this->solver_thread_.join();
+  {
+    std::lock_guard<std::mutex> lock(this->covariance_mutex_);
+    this->covariance_stop_ = true;
+  }
+  this->covariance_condition_.notify_one();
+  this->covariance_thread_.join();
+  delete this->covariance_recovery_;
+  delete this->optimization_;
   pthread_mutex_destroy(&this->odometry_gps_mutex_);
   pthread_mutex_destroy(&this->odom_mutex_);
 }
@@ -143,24 +201,13 @@ void GpsOdomOptimizationAlgNode::odom_callback(const nav_msgs::Odometry::ConstPt
 	  constraint_pt.covariance = Eigen::Matrix<double, 3, 3>::Identity();
 	  constraint_pt.information = Eigen::Matrix<double, 3, 3>::Identity();
 
-	  this->optimization_->addPointConstraint(constraint_pt);
+	  {
+		  std::lock_guard<std::mutex> lock(this->solver_mutex_);
+		  this->pending_constraints_pt_.push_back(constraint_pt);
+	  }
+	  this->solver_condition_.notify_one();
 	  ////////////////////////////////////////////////////////////////////////////////
 	  ////////////////////////////////////////////////////////////////////////////////
-
-	  if (this->optimization_->checkOptimization()){
-		  ////////////////////////////////////////////////////////////////////////////////
-		  //// COMPUTE OPTIMIZATION PROBLEM
-		  // residuals generation
-		  ceres::Problem problem;
-		  ceres::LocalParameterization* quaternion_local_parameterization = new ceres::EigenQuaternionParameterization;
-		  ceres::LossFunction* loss_function = new ceres::HuberLoss(0.01); //nullptr;//new ceres::HuberLoss(0.01);
-		  this->optimization_->generatePointResiduals(loss_function, quaternion_local_parameterization, &problem);
-
-		  // solve optimization problem
-		  this->optimization_->solveOptimizationProblem(&problem);
-		  ////////////////////////////////////////////////////////////////////////////////
-		  ////////////////////////////////////////////////////////////////////////////////
-	  }
   }
 
 
@@ -168,15 +215,14 @@ void GpsOdomOptimizationAlgNode::odom_callback(const nav_msgs::Odometry::ConstPt
   ///// GENERATE map -> odom TRANSFORM
   // generate 4x4 transform matrix map2odom
   //tf::Quaternion quaternion = tf::createQuaternionFromRPY(0, 0, yaw);
+  // last estimate of the solver thread, never waits for a solve in progress
+  Eigen::Vector3d map2odom_p;
+  Eigen::Quaterniond rot;
+  this->map2odom_buffer_.read(map2odom_p, rot);
   Eigen::Matrix4d tr_map2odom;
   tr_map2odom.setIdentity();
-  Eigen::Quaterniond rot(this->optimization_->getMapToOdom().q.w(),
-		  	  	  	  	 this->optimization_->getMapToOdom().q.x(),
-						 this->optimization_->getMapToOdom().q.y(),
-						 this->optimization_->getMapToOdom().q.z());
   tr_map2odom.block<3, 3>(0, 0) = rot.toRotationMatrix();
-  tr_map2odom.block<3, 1>(0, 3) = Eigen::Vector3d(this->optimization_->getMapToOdom().p.x(),
-		                                          this->optimization_->getMapToOdom().p.y(), 0.0);
+  tr_map2odom.block<3, 1>(0, 3) = Eigen::Vector3d(map2odom_p.x(), map2odom_p.y(), 0.0);
 
 
   Eigen::Quaterniond quat_final(tr_map2odom.block<3, 3>(0, 0));
@@ -216,6 +262,24 @@ void GpsOdomOptimizationAlgNode::odom_callback(const nav_msgs::Odometry::ConstPt
   this->localization_Odometry_msg_.pose.pose.orientation.z = quat_msg.z();
   this->localization_Odometry_msg_.pose.pose.orientation.w = quat_msg.w();
 
+  // covariance of map -> odom moved to the base, odom -> gps taken as exact: a rotation on the left of
+  // map -> odom also moves the base by its cross product with the odom -> gps offset (in the map frame)
+  Eigen::Matrix<double, 6, 6> map2odom_covariance;
+  if (this->map2odom_covariance_buffer_.read(map2odom_covariance) > 0)
+  {
+    Eigen::Vector3d offset = tr_map2base.block<3, 1>(0, 3) - tr_map2odom.block<3, 1>(0, 3);
+    Eigen::Matrix3d offset_cross;
+    offset_cross << 0.0, -offset.z(), offset.y(),
+                    offset.z(), 0.0, -offset.x(),
+                    -offset.y(), offset.x(), 0.0;
+    Eigen::Matrix<double, 6, 6> jacobian = Eigen::Matrix<double, 6, 6>::Identity();
+    jacobian.block<3, 3>(0, 3) = -offset_cross;
+    Eigen::Matrix<double, 6, 6> map2base_covariance = jacobian * map2odom_covariance * jacobian.transpose();
+    for (int i = 0; i < 6; i++)
+      for (int j = 0; j < 6; j++)
+        this->localization_Odometry_msg_.pose.covariance[6 * i + j] = map2base_covariance(i, j);
+  }
+
   this->localization_publisher_.publish(this->localization_Odometry_msg_);
 
   id++;
@@ -236,6 +300,93 @@ void GpsOdomOptimizationAlgNode::odom_mutex_exit(void)
 }
 
 
+void GpsOdomOptimizationAlgNode::solverThread(void)
+{
+  std::unique_lock<std::mutex> lock(this->solver_mutex_);
+  while (true)
+  {
+    while (!this->solver_stop_ && this->pending_constraints_pt_.empty())
+      this->solver_condition_.wait(lock);
+    if (this->solver_stop_)
+      break;
+
+    // the window and the problem belong to this thread, the callback only waits for the swap
+    std::swap(this->pending_constraints_pt_, this->taken_constraints_pt_);
+    lock.unlock();
+
+    for (size_t i = 0; i < this->taken_constraints_pt_.size(); i++)
+      this->optimization_->addPointConstraint(this->taken_constraints_pt_[i]);
+    this->taken_constraints_pt_.clear();
+
+    bool solved = this->optimization_->checkOptimization();
+    SolveReport report;
+    if (solved)
+    {
+      ////////////////////////////////////////////////////////////////////////////////
+      //// COMPUTE OPTIMIZATION PROBLEM
+      // the residuals of the window are kept in the persistent problem by addPointConstraint,
+      // the solve starts from the previous map -> odom
+      // bounded by the time budget, a solve cut short still improves on the previous estimate
+      report = this->optimization_->solveOptimizationProblem(this->solve_time_budget_);
+      if (report.usable)
+      {
+        this->map2odom_buffer_.write(this->optimization_->getMapToOdom());
+        // never waits on the low-priority thread (priority inversion): if it holds the lock the
+        // request is skipped, the next solve hands over a newer window
+        std::unique_lock<std::mutex> covariance_lock(this->covariance_mutex_, std::try_to_lock);
+        if (covariance_lock.owns_lock())
+        {
+          // the window is copied into storage of the same capacity, no allocation on the solve path
+          this->requested_constraints_pt_ = this->optimization_->getPointsConstraints();
+          this->requested_map2odom_ = this->optimization_->getMapToOdom();
+          this->covariance_requested_ = true;
+          covariance_lock.unlock();
+          this->covariance_condition_.notify_one();
+        }
+      }
+      if (!report.converged)
+        ROS_DEBUG("GpsOdomOptimizationAlgNode::solverThread: solve stopped after %d iterations in %.4f s",
+                  report.iterations, report.time);
+      ////////////////////////////////////////////////////////////////////////////////
+      ////////////////////////////////////////////////////////////////////////////////
+    }
+
+    lock.lock();
+    if (solved)
+    {
+      this->last_solve_report_ = report;
+      this->n_solves_++;
+      if (!report.converged)
+        this->n_unconverged_solves_++;
+    }
+  }
+}
+
+void GpsOdomOptimizationAlgNode::covarianceThread(void)
+{
+  std::unique_lock<std::mutex> lock(this->covariance_mutex_);
+  while (true)
+  {
+    while (!this->covariance_stop_ && !this->covariance_requested_)
+      this->covariance_condition_.wait(lock);
+    if (this->covariance_stop_)
+      break;
+
+    std::swap(this->requested_constraints_pt_, this->taken_covariance_constraints_pt_);
+    Pose3dWithCovariance map2odom = this->requested_map2odom_;
+    this->covariance_requested_ = false;
+    lock.unlock();
+
+    Eigen::Matrix<double, 6, 6> covariance;
+    if (this->covariance_recovery_->compute(this->taken_covariance_constraints_pt_, map2odom, covariance))
+      this->map2odom_covariance_buffer_.write(covariance);
+    else
+      ROS_DEBUG("GpsOdomOptimizationAlgNode::covarianceThread: map -> odom covariance not recovered");
+
+    lock.lock();
+  }
+}
+
 /*  [service callbacks] */
 
 /*  [action callbacks] */
@@ -253,6 +404,24 @@ void GpsOdomOptimizationAlgNode::node_config_update(Config &config, uint32_t lev
 
 void GpsOdomOptimizationAlgNode::addNodeDiagnostics(void)
 {
+  this->diagnostic_.add("solver", this, &GpsOdomOptimizationAlgNode::solverDiagnostics);
+}
+
+void GpsOdomOptimizationAlgNode::solverDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat)
+{
+  std::lock_guard<std::mutex> lock(this->solver_mutex_);
+
+  if (!this->last_solve_report_.converged)
+    stat.summaryf(diagnostic_msgs::DiagnosticStatus::WARN, "last solve stopped after %d iterations in %.4f s",
+                  this->last_solve_report_.iterations, this->last_solve_report_.time);
+  else
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "OK");
+
+  stat.add("solves", this->n_solves_);
+  stat.add("unconverged solves", this->n_unconverged_solves_);
+  stat.add("last solve iterations", this->last_solve_report_.iterations);
+  stat.add("last solve time [s]", this->last_solve_report_.time);
+  stat.add("time budget [s]", this->solve_time_budget_);
 }
 
 /* main function */
@@ -0,0 +1,420 @@
+// Evaluation throughput of the gps_odom_optimization cost functions.
+//
+// usage: gps_odom_optimization_benchmark [evaluations] [seed]
+//
+// Every cost function of ceres_structs.hpp is built both with the autodiff functor and with its
+// hand-derived version of ceres_analytic_structs.hpp on the same random measurements and
+// parameters. The residuals and jacobians of the two are compared, then each one is evaluated
+// `evaluations` times (default 1000000) with all the jacobians, as the solver does. The exit status
+// is non-zero if any residual or jacobian differs by more than 1e-9 (relative), or if the
+// steady-state map -> odom solves of OptimizationProcess do any heap allocation (glibc only).
+//
+// A second count covers the residual construction of the Ceres estimator: the in-place set() of
+// addPointConstraint and the pooled generateOdomResiduals / generatePriorResiduals into a reused
+// problem. AddResidualBlock allocates inside Ceres, so these must not allocate more than the same
+// calls with cost functions created beforehand. ceres::Solve and Ceres' own allocations are out of
+// scope.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "ceres_structs.hpp"
+#include "optimization_process.hpp"
+
+static const int N_SAMPLES = 64;
+static const double TOLERANCE = 1e-9;
+static const int N_STEADY_STATE_SOLVES = 1000;
+
+#ifdef __GLIBC__
+// every heap allocation goes through these, operator new and the Eigen aligned new included
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t n, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+
+static long allocations = 0;
+
+extern "C" void* malloc(size_t size) noexcept {
+	allocations++;
+	return __libc_malloc(size);
+}
+extern "C" void* calloc(size_t n, size_t size) noexcept {
+	allocations++;
+	return __libc_calloc(n, size);
+}
+extern "C" void* realloc(void* ptr, size_t size) noexcept {
+	allocations++;
+	return __libc_realloc(ptr, size);
+}
+extern "C" void* aligned_alloc(size_t alignment, size_t size) noexcept {
+	allocations++;
+	return __libc_memalign(alignment, size);
+}
+extern "C" int posix_memalign(void** ptr, size_t alignment, size_t size) noexcept {
+	allocations++;
+	*ptr = __libc_memalign(alignment, size);
+	return *ptr == NULL ? ENOMEM : 0;
+}
+#endif
+
+/**
+ * @brief Parameter blocks and cost functions of one random sample
+ */
+struct Sample {
+	std::vector<std::vector<double>> parameters;
+	ceres::CostFunction* autodiff;
+	ceres::CostFunction* analytic;
+};
+
+std::mt19937 generator;
+
+double uniform(double min, double max){
+	return std::uniform_real_distribution<double>(min, max)(generator);
+}
+
+Eigen::Vector3d randomPosition(double range){
+	return Eigen::Vector3d(uniform(-range, range), uniform(-range, range), uniform(-range, range));
+}
+
+// slightly off the unit sphere, as the solver sees them between two normalisations
+std::vector<double> randomQuaternion(void){
+	Eigen::Vector4d q(uniform(-1.0, 1.0), uniform(-1.0, 1.0), uniform(-1.0, 1.0), uniform(-1.0, 1.0));
+	q *= uniform(0.99, 1.01) / q.norm();
+	return std::vector<double>(q.data(), q.data() + 4);
+}
+
+// upper triangular square root information, as the one built from the covariances
+template <int N>
+Eigen::Matrix<double, N, N> randomInformation(void){
+	Eigen::Matrix<double, N, N> information = Eigen::Matrix<double, N, N>::Zero();
+	for (int i = 0; i < N; i++){
+		information(i, i) = uniform(0.5, 10.0);
+		for (int j = i + 1; j < N; j++){
+			information(i, j) = uniform(-1.0, 1.0);
+		}
+	}
+	return information;
+}
+
+std::vector<double> toVector(const Eigen::Vector3d& v){
+	return std::vector<double>(v.data(), v.data() + 3);
+}
+
+Eigen::Quaterniond randomRotation(void){
+	std::vector<double> q = randomQuaternion();
+	return Eigen::Quaterniond(q[3], q[0], q[1], q[2]).normalized();
+}
+
+Sample pointsSample(void){
+	Eigen::Vector3d det = randomPosition(50.0);
+	Eigen::Vector3d lm = randomPosition(50.0);
+	Eigen::Matrix<double, 3, 3> information = randomInformation<3>();
+	Sample sample;
+	sample.parameters.push_back(toVector(randomPosition(10.0)));
+	sample.parameters.push_back(randomQuaternion());
+	sample.autodiff = new ceres::AutoDiffCostFunction<PointsErrorTerm, 3, 3, 4>(new PointsErrorTerm(det, lm, information));
+	sample.analytic = analytic::PointsErrorTerm::Create(det, lm, information);
+	return sample;
+}
+
+Sample odometrySample(void){
+	Eigen::Vector3d tf_p = randomPosition(2.0);
+	Eigen::Quaterniond tf_q = randomRotation();
+	Eigen::Matrix<double, 6, 6> information = randomInformation<6>();
+	Sample sample;
+	sample.parameters.push_back(toVector(randomPosition(10.0)));
+	sample.parameters.push_back(randomQuaternion());
+	sample.parameters.push_back(toVector(randomPosition(10.0)));
+	sample.parameters.push_back(randomQuaternion());
+	sample.autodiff = new ceres::AutoDiffCostFunction<OdometryErrorTerm, 6, 3, 4, 3, 4>(
+			new OdometryErrorTerm(tf_p, tf_q, information));
+	sample.analytic = analytic::OdometryErrorTerm::Create(tf_p, tf_q, information);
+	return sample;
+}
+
+Sample priorSample(void){
+	Eigen::Vector3d p = randomPosition(50.0);
+	Eigen::Quaterniond q = randomRotation();
+	Eigen::Matrix<double, 6, 6> information = randomInformation<6>();
+	Sample sample;
+	sample.parameters.push_back(toVector(randomPosition(50.0)));
+	sample.parameters.push_back(randomQuaternion());
+	sample.autodiff = new ceres::AutoDiffCostFunction<PriorErrorTerm, 6, 3, 4>(new PriorErrorTerm(p, q, information));
+	sample.analytic = analytic::PriorErrorTerm::Create(p, q, information);
+	return sample;
+}
+
+/**
+ * @brief Residual and jacobian buffers of a cost function
+ */
+struct Evaluation {
+	std::vector<double> residuals;
+	std::vector<std::vector<double>> jacobians;
+	std::vector<double*> jacobian_ptrs;
+
+	Evaluation(const ceres::CostFunction& cost_function){
+		residuals.resize(cost_function.num_residuals());
+		const std::vector<int32_t>& sizes = cost_function.parameter_block_sizes();
+		jacobians.resize(sizes.size());
+		for (size_t i = 0; i < sizes.size(); i++){
+			jacobians[i].resize(cost_function.num_residuals() * sizes[i]);
+			jacobian_ptrs.push_back(jacobians[i].data());
+		}
+	}
+
+	bool run(const ceres::CostFunction& cost_function, const std::vector<const double*>& parameters){
+		return cost_function.Evaluate(parameters.data(), residuals.data(), jacobian_ptrs.data());
+	}
+};
+
+double relativeDifference(const std::vector<double>& a, const std::vector<double>& b){
+	double difference = 0.0;
+	for (size_t i = 0; i < a.size(); i++){
+		difference = std::max(difference, fabs(a[i] - b[i]) / std::max(1.0, fabs(a[i])));
+	}
+	return difference;
+}
+
+/**
+ * @brief Compares the two versions on every sample and times them, returns false on mismatch
+ */
+bool benchmark(const char* name, Sample (*generate)(void), long evaluations){
+	std::vector<Sample> samples;
+	std::vector<std::vector<const double*>> parameters(N_SAMPLES);
+	for (int i = 0; i < N_SAMPLES; i++){
+		samples.push_back(generate());
+		for (size_t j = 0; j < samples[i].parameters.size(); j++){
+			parameters[i].push_back(samples[i].parameters[j].data());
+		}
+	}
+
+	Evaluation autodiff(*samples[0].autodiff);
+	Evaluation analytic(*samples[0].analytic);
+	double max_difference = 0.0;
+	for (int i = 0; i < N_SAMPLES; i++){
+		autodiff.run(*samples[i].autodiff, parameters[i]);
+		analytic.run(*samples[i].analytic, parameters[i]);
+		max_difference = std::max(max_difference, relativeDifference(autodiff.residuals, analytic.residuals));
+		for (size_t j = 0; j < autodiff.jacobians.size(); j++){
+			max_difference = std::max(max_difference, relativeDifference(autodiff.jacobians[j], analytic.jacobians[j]));
+		}
+	}
+
+	double seconds[2];
+	for (int version = 0; version < 2; version++){
+		Evaluation& evaluation = version == 0 ? autodiff : analytic;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (long i = 0; i < evaluations; i++){
+			const Sample& sample = samples[i % N_SAMPLES];
+			evaluation.run(version == 0 ? *sample.autodiff : *sample.analytic, parameters[i % N_SAMPLES]);
+		}
+		seconds[version] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	printf("%-18s autodiff %8.1f ns  analytic %8.1f ns  speedup %5.2fx  max difference %.3g%s\n", name,
+			1e9 * seconds[0] / evaluations, 1e9 * seconds[1] / evaluations, seconds[0] / seconds[1],
+			max_difference, max_difference > TOLERANCE ? "  MISMATCH" : "");
+
+	for (size_t i = 0; i < samples.size(); i++){
+		delete samples[i].autodiff;
+		delete samples[i].analytic;
+	}
+	return max_difference <= TOLERANCE;
+}
+
+/**
+ * @brief A GPS fix along a circle, the odometry is map -> odom (yaw, x, y) away from it
+ */
+PointsConstraint fixSample(double t){
+	const double yaw = 0.3, x = 12.0, y = -4.0;
+	PointsConstraint constraint;
+	constraint.id = 0;
+	constraint.detection = Eigen::Vector3d(20.0 * cos(t), 20.0 * sin(t), 0.0);
+	constraint.landmark = Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()) * constraint.detection
+			+ Eigen::Vector3d(x + uniform(-0.1, 0.1), y + uniform(-0.1, 0.1), 0.0);
+	constraint.covariance = Eigen::Matrix<double, 3, 3>::Identity();
+	constraint.information = Eigen::Matrix<double, 3, 3>::Identity();
+	return constraint;
+}
+
+/**
+ * @brief Counts the heap allocations of the steady-state solves, returns false if there are any
+ *
+ * Once the window is full, each fix overwrites the oldest one and map -> odom is solved with the
+ * closed form, as in the solver thread of the node. The Ceres fallback allocates its own evaluation
+ * state and is not covered.
+ */
+bool allocationCheck(void){
+#ifdef __GLIBC__
+	OptimizationProcess optimization;
+	double t = 0.0;
+	for (int i = 0; i < 2 * optimization.getWindowSize(); i++, t += 0.05){
+		optimization.addPointConstraint(fixSample(t));
+		optimization.solveOptimizationProblem();
+	}
+
+	long start = allocations;
+	for (int i = 0; i < N_STEADY_STATE_SOLVES; i++, t += 0.05){
+		optimization.addPointConstraint(fixSample(t));
+		optimization.solveOptimizationProblem();
+	}
+	long counted = allocations - start;
+
+	printf("%-18s %ld heap allocations in %d steady-state solves%s\n", "OptimizationProcess", counted,
+			N_STEADY_STATE_SOLVES, counted > 0 ? "  ALLOCATES" : "");
+	return counted == 0;
+#else
+	return true;
+#endif
+}
+
+/**
+ * @brief Removes the residual blocks of a reused problem, its parameter blocks stay
+ */
+void clearResidualBlocks(ceres::Problem& problem){
+	std::vector<ceres::ResidualBlockId> residual_blocks;
+	problem.GetResidualBlocks(&residual_blocks);
+	for (size_t i = 0; i < residual_blocks.size(); i++){
+		problem.RemoveResidualBlock(residual_blocks[i]);
+	}
+}
+
+/**
+ * @brief Counts the heap allocations of the residual construction of the Ceres estimator
+ *
+ * Full windows of poses, odometry and prior constraints. Every step adds a fix and generates the
+ * odometry and prior residuals into a reused problem, whose residual blocks are removed after a
+ * solve. The same AddResidualBlock and SetParameterization calls with cost functions created
+ * beforehand give the allocations of Ceres itself, the residual construction must not add any.
+ */
+bool residualAllocationCheck(void){
+#ifdef __GLIBC__
+	OptimizationProcess optimization;
+	optimization.setEstimator(OptimizationProcess::CERES);
+	const int window_size = optimization.getWindowSize();
+	const Eigen::Vector3d tf_p(2.0, 0.1, 0.0);
+	const Eigen::Quaterniond tf_q(Eigen::AngleAxisd(0.01, Eigen::Vector3d::UnitZ()));
+	double t = 0.0;
+	for (int i = 0; i < window_size; i++, t += 0.05){
+		Pose3dWithCovariance pose = parsePose2dToPose3d(i, 2.0 * i, 0.1 * i, 0.01 * i,
+														Eigen::Matrix<double, 6, 6>::Identity());
+		optimization.addPose3dToTrajectoryEstimated(pose);
+		PriorConstraint prior = pose;
+		prior.information = Eigen::Matrix<double, 6, 6>::Identity();
+		optimization.addPriorConstraint(prior);
+		if (i > 0){
+			OdometryConstraint odometry;
+			odometry.id_begin = i - 1;
+			odometry.id_end = i;
+			odometry.tf_p = tf_p;
+			odometry.tf_q = tf_q;
+			odometry.covariance = Eigen::Matrix<double, 6, 6>::Identity();
+			odometry.information = Eigen::Matrix<double, 6, 6>::Identity();
+			optimization.addOdometryConstraint(odometry);
+		}
+		optimization.addPointConstraint(fixSample(t));
+	}
+
+	ceres::Problem::Options problem_options;
+	problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+	problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+	problem_options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+	problem_options.enable_fast_removal = true;
+	ceres::Problem problem(problem_options);
+	ceres::Problem baseline_problem(problem_options);
+	ceres::HuberLoss loss_function(optimization.getHuberDelta());
+	ceres::EigenQuaternionParameterization quaternion_local_parameterization;
+
+	// the baseline adds the same number of blocks of the same shapes on two poses of its own
+	const Eigen::Matrix<double, 6, 6> information = Eigen::Matrix<double, 6, 6>::Identity();
+#ifdef GPS_ODOM_SE2
+	ceres::CostFunction* odometry_cost = OdometryErrorTermSE2::Create(tf_p, tf_q, information);
+	ceres::CostFunction* prior_cost = PriorErrorTermSE2::Create(tf_p, tf_q, information);
+	double pose_a[3] = {0.0, 0.0, 0.0};
+	double pose_b[3] = {2.0, 0.1, 0.01};
+#else
+	ceres::CostFunction* odometry_cost = OdometryErrorTerm::Create(tf_p, tf_q, information);
+	ceres::CostFunction* prior_cost = PriorErrorTerm::Create(tf_p, tf_q, information);
+	double p_a[3] = {0.0, 0.0, 0.0}, q_a[4] = {0.0, 0.0, 0.0, 1.0};
+	double p_b[3] = {2.0, 0.1, 0.0}, q_b[4] = {0.0, 0.0, 0.0, 1.0};
+#endif
+
+	long residual_allocations = 0;
+	long ceres_allocations = 0;
+	// the first step adds the parameter blocks to the reused problems, it is not counted
+	for (int i = -1; i < N_STEADY_STATE_SOLVES; i++, t += 0.05){
+		PointsConstraint fix = fixSample(t);
+
+		long start = allocations;
+		optimization.addPointConstraint(fix);
+		optimization.generateOdomResiduals(&loss_function, &quaternion_local_parameterization, &problem);
+		optimization.generatePriorResiduals(&loss_function, &quaternion_local_parameterization, &problem);
+		long counted = allocations - start;
+
+		start = allocations;
+		for (int j = 1; j < window_size; j++){
+#ifdef GPS_ODOM_SE2
+			baseline_problem.AddResidualBlock(odometry_cost, &loss_function, pose_a, pose_b);
+#else
+			baseline_problem.AddResidualBlock(odometry_cost, &loss_function, p_a, q_a, p_b, q_b);
+			baseline_problem.SetParameterization(q_a, &quaternion_local_parameterization);
+			baseline_problem.SetParameterization(q_b, &quaternion_local_parameterization);
+#endif
+		}
+		for (int j = 0; j < window_size; j++){
+#ifdef GPS_ODOM_SE2
+			baseline_problem.AddResidualBlock(prior_cost, &loss_function, pose_a);
+#else
+			baseline_problem.AddResidualBlock(prior_cost, &loss_function, p_a, q_a);
+			baseline_problem.SetParameterization(q_a, &quaternion_local_parameterization);
+#endif
+		}
+		long baseline = allocations - start;
+
+		if (i >= 0){
+			residual_allocations += counted;
+			ceres_allocations += baseline;
+		}
+
+		optimization.solveOptimizationProblem(&problem);
+		clearResidualBlocks(problem);
+		clearResidualBlocks(baseline_problem);
+	}
+
+	delete odometry_cost;
+	delete prior_cost;
+
+	long excess = residual_allocations - ceres_allocations;
+	printf("%-18s %ld heap allocations in %d residual constructions, %ld of them in Ceres%s\n", "generate*Residuals",
+			residual_allocations, N_STEADY_STATE_SOLVES, ceres_allocations, excess > 0 ? "  ALLOCATES" : "");
+	return excess <= 0;
+#else
+	return true;
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+	long evaluations = argc > 1 ? atol(argv[1]) : 1000000;
+	if (evaluations <= 0){
+		fprintf(stderr, "usage: %s [evaluations] [seed]\n", argv[0]);
+		return 1;
+	}
+	generator.seed(argc > 2 ? atoi(argv[2]) : 1);
+
+	printf("evaluate + jacobians, %ld evaluations per cost function\n", evaluations);
+	bool equivalent = true;
+	equivalent &= benchmark("PointsErrorTerm", pointsSample, evaluations);
+	equivalent &= benchmark("OdometryErrorTerm", odometrySample, evaluations);
+	equivalent &= benchmark("PriorErrorTerm", priorSample, evaluations);
+	bool allocation_free = allocationCheck();
+	allocation_free &= residualAllocationCheck();
+
+	if (!equivalent)
+		return 2;
+	return allocation_free ? 0 : 3;
+}